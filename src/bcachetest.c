@@ -0,0 +1,74 @@
+// Buffer cache throughput benchmark.
+//
+// Forks NCHILD processes that each repeatedly re-read a small file
+// of their own.  The files fit in the buffer cache, so almost every
+// read is a bget() hit; with a single bcache lock all CPUs serialize
+// on it, with per-bucket locks the hits proceed in parallel.
+// Run it with different CPUS= settings to see how it scales.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+
+#define NCHILD  4
+#define NBLOCK  4     // blocks per file; NCHILD*NBLOCK must fit in NBUF
+#define NROUND  500
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, j, n;
+  uint t0, t1;
+  char path[] = "bcache0";
+  char data[BSIZE];
+
+  printf(1, "bcachetest starting\n");
+  memset(data, 'b', sizeof(data));
+
+  for(i = 0; i < NCHILD; i++){
+    path[6] = '0' + i;
+    fd = open(path, O_CREATE | O_RDWR);
+    if(fd < 0){
+      printf(1, "bcachetest: create %s failed\n", path);
+      exit();
+    }
+    for(j = 0; j < NBLOCK; j++)
+      write(fd, data, sizeof(data));
+    close(fd);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < NCHILD; i++){
+    if(fork() == 0){
+      path[6] = '0' + i;
+      for(n = 0; n < NROUND; n++){
+        if((fd = open(path, O_RDONLY)) < 0){
+          printf(1, "bcachetest: open %s failed\n", path);
+          exit();
+        }
+        for(j = 0; j < NBLOCK; j++)
+          read(fd, data, sizeof(data));
+        close(fd);
+      }
+      exit();
+    }
+  }
+  for(i = 0; i < NCHILD; i++)
+    wait();
+  t1 = uptime();
+
+  // every round also reads the inode and the directory blocks
+  n = NCHILD * NROUND * NBLOCK;
+  printf(1, "bcachetest: %d block reads in %d ticks", n, t1 - t0);
+  if(t1 > t0)
+    printf(1, " (%d reads/tick)", n / (t1 - t0));
+  printf(1, "\n");
+
+  for(i = 0; i < NCHILD; i++){
+    path[6] = '0' + i;
+    unlink(path);
+  }
+  exit();
+}
@@ -0,0 +1,75 @@
+// Sequential file throughput benchmark.
+//
+// Writes a file of the given number of KB (default 1024) in
+// BUFSZ-byte writes, reads it back the same way, and prints both
+// transfer rates.  Time is measured with clock().  The default
+// fs.img holds about 1.5MB of free space; build it with e.g.
+// make FSSIZE=40000 to try multi-megabyte files.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "date.h"
+
+#define BUFSZ  8192
+
+char buf[BUFSZ];
+
+static void
+report(char *what, int kb, uint us)
+{
+  // KB/s, timed to 100us so that kb*10000 does not overflow
+  if(us < 100)
+    us = 100;
+  printf(1, "bigbench: %s %d KB in %d us, %d KB/s\n",
+         what, kb, us, (uint)kb * 10000 / (us / 100));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, n, kb;
+  struct clockval t0, t1;
+
+  kb = 1024;
+  if(argc > 1)
+    kb = atoi(argv[1]);
+  n = kb * 1024 / BUFSZ;
+  printf(1, "bigbench starting: %d KB\n", n * BUFSZ / 1024);
+  unlink("bigbench.tmp");
+
+  clock(&t0);
+  if((fd = open("bigbench.tmp", O_CREATE | O_RDWR)) < 0){
+    printf(1, "bigbench: create failed\n");
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    ((int*)buf)[0] = i;
+    if(write(fd, buf, BUFSZ) != BUFSZ){
+      printf(1, "bigbench: write failed at %d KB\n", i * BUFSZ / 1024);
+      exit();
+    }
+  }
+  close(fd);
+  clock(&t1);
+  report("wrote", n * BUFSZ / 1024, clockus(&t0, &t1));
+
+  clock(&t0);
+  if((fd = open("bigbench.tmp", O_RDONLY)) < 0){
+    printf(1, "bigbench: open failed\n");
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    if(read(fd, buf, BUFSZ) != BUFSZ || ((int*)buf)[0] != i){
+      printf(1, "bigbench: read failed at %d KB\n", i * BUFSZ / 1024);
+      exit();
+    }
+  }
+  close(fd);
+  clock(&t1);
+  report("read", n * BUFSZ / 1024, clockus(&t0, &t1));
+
+  unlink("bigbench.tmp");
+  exit();
+}
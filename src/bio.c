@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -13,10 +13,25 @@
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
 //
-// The implementation uses two state flags internally:
+// * breadahead starts reading a block the caller expects to need
+//     soon, without waiting or keeping the buffer.
+//
+// The implementation uses three state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+// * B_ASYNC: the buffer is locked for a read-ahead, and the
+//     disk driver calls bdone to release it when the read is done.
+//
+// Blocks are bsize bytes, set from the super block by bsetsize when
+// the file system is mounted; each buffer's data is a page, enough
+// for the largest block size, allocated by binit.
+//
+// Buffers are hashed by (dev, blockno) into NBUCKET buckets, each
+// protected by its own spinlock, so lookups of different blocks on
+// different CPUs do not contend.  bcache.lock only serializes
+// eviction: a miss takes it, picks the least recently released
+// unused buffer across all buckets, and moves it to the new bucket.
 
 #include "types.h"
 #include "defs.h"
@@ -25,87 +40,214 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "mmu.h"
+#include "proc.h"
+
+// prime so that consecutive block numbers spread over all buckets
+#define NBUCKET 13
+// Most read-ahead buffers in flight at once.
+#define NAHEAD (NBUF/2)
+// Read-ahead takes a buffer only if more than this many are free.
+// The log pins up to 2*LOGSIZE buffers (the open transaction and
+// the committing one), and each CPU may be in the middle of an
+// operation that needs up to MAXOPBLOCKS more; read-ahead must
+// leave those, or an ordinary bread would find no buffer.
+#define BRESERVE (MAXOPBLOCKS*ncpu)
+
+struct bucket {
+  struct spinlock lock;
+  // Doubly-linked list of the buffers hashed here, through prev/next.
+  struct buf head;
+};
+
+uint bsize = BSIZE;
 
 struct {
+  // Serializes eviction (moving a buffer between buckets).
   struct spinlock lock;
   // bufferの実体
   struct buf buf[NBUF];
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  // LRUであり，使われたバッファは先頭につなぎ直す
-  // cacheへのアクセスはbufではなくheadからのリストを介して行われる
-  struct buf head;
+  // cacheへのアクセスはbufではなくbucketのリストを介して行われる
+  struct bucket bucket[NBUCKET];
+
+  // read-ahead buffers locked for the disk
+  int nahead;
 } bcache;
 
-// 双方向リストであるバッファリストを初期化する
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+static void
+blink(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
+// 各bucketの双方向リストを初期化し，全バッファをbucket 0につなぐ
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
   // bcacheのlockを初期化
   initlock(&bcache.lock, "bcache");
 
 //PAGEBREAK!
-  // Create linked list of buffers
+  // Create the (empty) hash chains.
   // 自分自身を指すようにリストを初期化
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
+  // Unused buffers start out in bucket 0; eviction moves them
+  // to the bucket of whatever block they end up caching.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    if((b->data = (uchar*)kalloc()) == 0)
+      panic("binit: out of memory");
+    b->lastuse = 0;
+    blink(&bcache.bucket[0], b);
   }
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Look for block on device dev in bucket bk, whose lock must be held.
+// If found, take a reference and return it.
 static struct buf*
-bget(uint dev, uint blockno)
+blookup(struct bucket *bk, uint dev, uint blockno)
 {
   struct buf *b;
 
-  // buffer cache をロックする
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head.next; b != &bk->head; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
-	  // buffer単位でsleeplock
-	  // これからこのバッファを使うからロックを獲得
-      acquiresleep(&b->lock);
       return b;
     }
   }
+  return 0;
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return locked buffer.
+// For read-ahead (ahead set), return only a newly allocated
+// buffer, and 0 if the block is cached or buffers are short
+// (see BRESERVE).
+static struct buf*
+bget(uint dev, uint blockno, int ahead)
+{
+  struct buf *b, *victim;
+  struct bucket *bk, *vbk, *p;
+  int found, nfree;
+
+  bk = bhash(dev, blockno);
+
+  // Is the block already cached?
+  // 対象のbucketだけをロックする
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  if(b && ahead)
+    b->refcnt--;
+  release(&bk->lock);
+  if(b && ahead)
+    return 0;
+  if(b){
+    // buffer単位でsleeplock
+    // これからこのバッファを使うからロックを獲得
+    acquiresleep(&b->lock);
+    return b;
+  }
 
   // Not cached; recycle an unused buffer.
+  // Only one CPU evicts at a time, so while we hold bcache.lock
+  // no one else can insert this block; but someone may have done
+  // so between our lookup and acquiring bcache.lock, so look again.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  if(b && ahead)
+    b->refcnt--;
+  release(&bk->lock);
+  if(b){
+    release(&bcache.lock);
+    if(ahead)
+      return 0;
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  // Find the least recently released buffer in any bucket.
   // Even if refcnt==0, B_DIRTY indicates a buffer is in use
   // because log.c has modified it but not yet committed it.
-  // bcache.head.prevはリストの末尾
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-	// 現在どのスレッドも使用していなくて，書き戻しも必要ない
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-	  // flagsはB_VALIDでもB_DIRTYでもない
-	  // breadによってdiskから正しく読みだしてくれる
-	  // B_VALIDだったら以前のdataを使用してしまう
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-	  // refcntがすでに1であるため，reusedされる心配はないため，
-	  // bcacheをreleaseしたあとでもおっけー
-      acquiresleep(&b->lock);
-      return b;
+  // The victim's bucket stays locked until it is unlinked, so
+  // its refcnt cannot change under us.  Holding two bucket locks
+  // is safe because every other path holds at most one.
+  victim = 0;
+  vbk = 0;
+  nfree = 0;
+  for(p = bcache.bucket; p < bcache.bucket+NBUCKET; p++){
+    acquire(&p->lock);
+    found = 0;
+    for(b = p->head.next; b != &p->head; b = b->next){
+      // 現在どのスレッドも使用していなくて，書き戻しも必要ない
+      if(b->refcnt != 0 || (b->flags & B_DIRTY))
+        continue;
+      nfree++;
+      if(victim == 0 || b->lastuse < victim->lastuse){
+        victim = b;
+        found = 1;
+      }
     }
+    if(found){
+      if(vbk)
+        release(&vbk->lock);
+      vbk = p;
+    } else
+      release(&p->lock);
   }
-  panic("bget: no buffers");
+  if(ahead && nfree <= BRESERVE){
+    if(vbk)
+      release(&vbk->lock);
+    release(&bcache.lock);
+    return 0;
+  }
+  if(victim == 0)
+    panic("bget: no buffers");
+
+  bunlink(victim);
+  release(&vbk->lock);
+
+  // flagsはB_VALIDでもB_DIRTYでもない
+  // breadによってdiskから正しく読みだしてくれる
+  // B_VALIDだったら以前のdataを使用してしまう
+  victim->dev = dev;
+  victim->blockno = blockno;
+  victim->flags = 0;
+  victim->refcnt = 1;
+  acquire(&bk->lock);
+  blink(bk, victim);
+  release(&bk->lock);
+  release(&bcache.lock);
+
+  // refcntがすでに1であるため，reusedされる心配はないため，
+  // bcacheをreleaseしたあとでもおっけー
+  acquiresleep(&victim->lock);
+  return victim;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -116,7 +258,7 @@ bread(uint dev, uint blockno)
 
   // devのblocknoからblockを読み出す
   // もしキャッシュになかったら空いてるキャッシュに情報だけを詰める
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   // キャッシュに入ったばかりの場合はまだデータが入っていないため，ディスクから読み出す
   // 有効でないバッファを有効にする
   if((b->flags & B_VALID) == 0) {
@@ -126,6 +268,86 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Switch to blocks of size bytes.  Called when the file system is
+// mounted, with no buffer in use; blocks cached so far were read
+// with the old size, so mark them all invalid.
+void
+bsetsize(uint size)
+{
+  struct buf *b;
+
+  if(size < BSIZE || size > MAXBSIZE || size > PGSIZE || (size & (size-1)))
+    panic("bsetsize");
+  acquire(&bcache.lock);
+  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
+    if(b->refcnt != 0 || (b->flags & B_DIRTY))
+      panic("bsetsize: busy");
+    b->flags = 0;
+  }
+  bsize = size;
+  release(&bcache.lock);
+}
+
+// Start reading block blockno into the cache, and return without
+// waiting for it or keeping the buffer.  The buffer stays locked
+// until the read completes and the disk driver calls bdone; a
+// bread of the block meanwhile waits for that lock.  Read-ahead is
+// only a hint: do nothing if the block is already cached, or if
+// buffers are short.  Return 0 in the latter case, 1 if the block
+// is cached or on its way.
+int
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+  struct bucket *bk;
+
+  if(bcache.nahead >= NAHEAD)
+    return 0;
+  if((b = bget(dev, blockno, 1)) == 0){
+    bk = bhash(dev, blockno);
+    acquire(&bk->lock);
+    if((b = blookup(bk, dev, blockno)) != 0)
+      b->refcnt--;
+    release(&bk->lock);
+    return b != 0;
+  }
+  __sync_fetch_and_add(&bcache.nahead, 1);
+  b->flags |= B_ASYNC;
+  idesubmit(b);
+  return 1;
+}
+
+// Called by the disk driver, possibly from its interrupt handler,
+// when the read of a breadahead buffer completes: release it.
+void
+bdone(struct buf *b)
+{
+  struct bucket *bk;
+
+  b->flags &= ~B_ASYNC;
+  __sync_fetch_and_sub(&bcache.nahead, 1);
+  releasesleep(&b->lock);
+
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt--;
+  if(b->refcnt == 0)
+    b->lastuse = ticks;
+  release(&bk->lock);
+}
+
+// Return a locked buf for a block whose contents the caller
+// is about to overwrite entirely, without reading it from disk.
+struct buf*
+bgetblank(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  b->flags |= B_VALID;
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 // b.lockが獲得された状態でないといけない
 // bread(dev, blockno)でb->lockが獲得された状態でbがかえってくるため，
@@ -143,30 +365,48 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Start writing b's contents to disk and return without waiting,
+// so that the caller can queue more blocks for the disk to merge
+// and sort.  b must stay locked until bwait(b) returns.
+void
+bawrite(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bawrite");
+  b->flags |= B_DIRTY;
+  idesubmit(b);
+}
+
+// Wait for a write started by bawrite to finish.
+void
+bwait(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwait");
+  ideawait(b);
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Stamp it with the release time for the eviction scan in bget.
 // バッファの使用終了処理
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->lastuse = ticks;
   }
-  
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 //PAGEBREAK!
 // Blank page.
@@ -11,12 +11,15 @@ struct buf {
   // reference count: 現在参照しているスレッドの数, buffer cacheの処理で利用される
   uint refcnt;
   // cache用の変数
-  struct buf *prev; // LRU cache list
+  uint lastuse;     // ticks at last brelse, for LRU eviction
+  struct buf *prev; // hash bucket list
   struct buf *next;
   // diskで処理されるbufを連結リストで管理(iderw, ideintrなどで利用される)
   struct buf *qnext; // disk queue
-  uchar data[BSIZE];
+  uint qtime;        // ticks when queued, for the disk's deadline
+  uchar *data;       // bsize bytes, in a page of its own
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // read-ahead: released by bdone when the read completes
 
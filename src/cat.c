@@ -9,6 +9,12 @@ cat(int fd)
 {
   int n;
 
+  // Let the kernel move the data; fall back to copying it
+  // through buf if it cannot.
+  while((n = splice(fd, 1, 4096)) > 0)
+    ;
+  if(n == 0)
+    return;
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
       printf(1, "cat: write error\n");
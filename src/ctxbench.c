@@ -0,0 +1,69 @@
+// Context switch benchmark.
+//
+// A parent and a child pass a byte back and forth through two
+// pipes NROUND times.  Each round trip blocks and wakes each side
+// once, so it costs two sleeps, two wakeups and at least two
+// context switches (more if the two run on different CPUs and
+// the reader must be woken by an IPI).
+// Run it with different CPUS= settings to compare.  With one CPU
+// every switch is between the two processes' page tables, and only
+// the kernel's global TLB entries survive it; with more, each side
+// usually sleeps and wakes on a CPU of its own, which still has its
+// page table loaded (see "lazy" in the ^P listing).  Time is measured
+// with clock().
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "date.h"
+
+#define NROUND  10000
+
+int
+main(int argc, char *argv[])
+{
+  int ping[2], pong[2];
+  int i, pid;
+  struct clockval t0, t1;
+  uint us;
+  char c;
+
+  printf(1, "ctxbench starting\n");
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    printf(1, "ctxbench: pipe failed\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf(1, "ctxbench: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 0; i < NROUND; i++){
+      if(read(ping[0], &c, 1) != 1)
+        break;
+      write(pong[1], &c, 1);
+    }
+    exit();
+  }
+
+  c = 'x';
+  clock(&t0);
+  for(i = 0; i < NROUND; i++){
+    write(ping[1], &c, 1);
+    if(read(pong[0], &c, 1) != 1){
+      printf(1, "ctxbench: read failed\n");
+      break;
+    }
+  }
+  clock(&t1);
+  wait();
+
+  us = clockus(&t0, &t1);
+  printf(1, "ctxbench: %d round trips in %d us", i, us);
+  if(i > 0)
+    printf(1, " (%d.%d us each)", us / i, us * 10 / i % 10);
+  printf(1, "\n");
+  exit();
+}
@@ -1,3 +1,15 @@
+// Time since boot from clock(): whole clock ticks, plus the
+// part of the current tick in units of 1/CLOCKRES tick.
+#define CLOCKRES 1000000
+// Clock ticks a second.  This is nominal: lapic.c's timer count is
+// not calibrated against real time, so times converted with it,
+// as clockus does, are only as right as the guess.
+#define HZ 100
+struct clockval {
+  uint ticks;
+  uint frac;
+};
+
 struct rtcdate {
   uint second;
   uint minute;
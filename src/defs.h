@@ -1,20 +1,30 @@
 struct buf;
+struct clockval;
 struct context;
 struct file;
 struct inode;
 struct pipe;
 struct proc;
 struct rtcdate;
+struct schedinfo;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct trapframe;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bgetblank(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bawrite(struct buf*);
+void            bwait(struct buf*);
+int             breadahead(uint, uint);
+void            bsetsize(uint);
+extern uint     bsize;
+void            bdone(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -33,6 +43,7 @@ void            fileinit(void);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filesplice(struct file*, struct file*, int n);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
@@ -40,7 +51,9 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            iexec(struct inode*);
 void            iinit(int dev);
+void            iputexec(struct inode*);
 void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
@@ -50,6 +63,7 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+int             readiput(struct inode*, uint, uint, int (*)(void*, char*, int), void*);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
@@ -57,6 +71,10 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            idesubmit(struct buf*);
+void            ideawait(struct buf*);
+void            ideplug(void);
+void            ideunplug(void);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -66,8 +84,12 @@ void            ioapicinit(void);
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+void            kincref(char*);
+int             kunref(char*);
+int             krefcnt(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kmemdump(void);
 
 // kbd.c
 void            kbdintr(void);
@@ -78,6 +100,10 @@ int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(int, int);
+void            lapiconeshot(uint, uint);
+void            lapicperiodic(void);
+extern uint     tscpertick;
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
@@ -86,6 +112,7 @@ void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
+void            log_sync(void);
 
 // mp.c
 extern int      ismp;
@@ -100,21 +127,28 @@ int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
+int             pipeput(void*, char*, int);
+int             pipewaitspace(struct pipe*);
 
 //PAGEBREAK: 16
 // proc.c
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             getsched(int, struct schedinfo*);
 int             growproc(int);
 int             kill(int);
+void            kthread(char*, void (*)(void));
+struct cpu*     cpulookup(void);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
+int             schedtick(void);
 void            setproc(struct proc*);
+int             setsched(int, int, int);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
@@ -129,6 +163,7 @@ void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            lockdump(void);
 void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
@@ -154,13 +189,20 @@ int             argptr(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
+void            fastsyscall(struct trapframe*);
 void            syscall(void);
 
 // timer.c
+void            clockintr(void);
+void            clockread(struct clockval*);
+void            timeridle(void);
 void            timerinit(void);
+int             timersleep(uint);
+void            tsleep(void*, uint);
 
 // trap.c
 void            idtinit(void);
+extern int      sysenterok;
 extern uint     ticks;
 void            tvinit(void);
 extern struct spinlock tickslock;
@@ -181,6 +223,9 @@ void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
+int             cowfault(pde_t*, uint);
+int             pagefault(struct proc*, uint, uint);
+int             faultin(struct proc*, uint, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
@@ -14,8 +14,10 @@ exec(char *path, char **argv)
   int i, off;
   uint argc, sz, sp, ustack[3+MAXARG+1];
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe, *oldexe;
   struct proghdr ph;
+  struct progseg seg[NPSEG];
+  int nseg;
   pde_t *pgdir, *oldpgdir;
   struct proc *curproc = myproc();
 
@@ -31,6 +33,7 @@ exec(char *path, char **argv)
   // inodeをロックし、必要に応じてディスクから読み出す
   ilock(ip);
   pgdir = 0;
+  exe = 0;
 
   // Check ELF header
   // readi(struct inode *ip, char *dst, uint off, uint n): ipのoffからnbyteだけdstに読み出す
@@ -45,9 +48,13 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Map program.
   // プログラムヘッダを読み込み(xv6では1つだが、他のシステムでは複数存在)
+  // Segments are only recorded here; their pages are read from ip
+  // by pagefault() when the program first touches them.  If there
+  // are more than NPSEG, the rest are loaded now as before.
   sz = 0;
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -57,19 +64,34 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-	// 仮想アドレス空間における[0, ph.vaddr+memsz]の領域を確保
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz >= KERNBASE)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
+      goto bad;
+    if(nseg < NPSEG){
+      seg[nseg].vaddr = ph.vaddr;
+      seg[nseg].memsz = ph.memsz;
+      seg[nseg].off = ph.off;
+      seg[nseg].filesz = ph.filesz;
+      nseg++;
+      if(ph.vaddr + ph.memsz > sz)
+        sz = ph.vaddr + ph.memsz;
+      continue;
+    }
+	// 仮想アドレス空間における[0, ph.vaddr+memsz]の領域を確保
+    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
       goto bad;
 	// 確保した[0, ph.vaddr+memsz]に対してプログラムを読みだす
     if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
   // inodeのロックの解除
-  iunlockput(ip);
+  // Keep the reference for demand paging.
+  iexec(ip);
+  iunlock(ip);
   // FSのfinalize
   end_op();
+  exe = ip;
   ip = 0;
 
   // Allocate two pages at the next page boundary.
@@ -118,8 +140,13 @@ exec(char *path, char **argv)
   // curproc->pgdirに入っているのはpgdirの物理アドレス
   // つまり、P2V(oldpgdir)を行えば、カーネルの仮想アドレス空間からアクセス可能
   oldpgdir = curproc->pgdir;
+  oldexe = curproc->exe;
   curproc->pgdir = pgdir;
   curproc->sz = sz;
+  curproc->exe = exe;
+  memmove(curproc->seg, seg, sizeof(seg));
+  curproc->nseg = nseg;
+  curproc->npagein = 0;
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;  // あたかもmain関数が呼び出されたかのように自前でセットしたユーザスタックのスタックポインタ
   // pgdirを新しいものに変更
@@ -127,6 +154,11 @@ exec(char *path, char **argv)
   switchuvm(curproc);
   // freevm内で、物理アドレスをカーネルの仮想アドレス空間の仮想アドレスに変換するため、ページテーブルが切り替わっていてもoldpgdirにアクセス可能
   freevm(oldpgdir);
+  if(oldexe){
+    begin_op();
+    iputexec(oldexe);
+    end_op();
+  }
   return 0;
 
  bad:
@@ -136,5 +168,10 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    begin_op();
+    iputexec(exe);
+    end_op();
+  }
   return -1;
 }
@@ -5,6 +5,8 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "stat.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
@@ -126,11 +128,14 @@ filewrite(struct file *f, char *addr, int n)
   if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // i-node, allocation blocks, and 2 blocks of slop
+    // for non-aligned writes.  A new extent slot may
+    // allocate an indirect block at each of NLEVEL levels
+    // (each with its allocation block), and growing the
+    // last extent writes the block holding it: NLEVEL+1.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+    int max = ((MAXOPBLOCKS-1-(NLEVEL+1)-NLEVEL-2) / 2) * bsize;
     int i = 0;
     while(i < n){
       int n1 = n - i;
@@ -146,12 +151,73 @@ filewrite(struct file *f, char *addr, int n)
 
       if(r < 0)
         break;
-      if(r != n1)
-        panic("short filewrite");
       i += r;
+      if(r != n1)
+        break;  // out of extents or MAXFILESIZE
+
     }
     return i == n ? n : -1;
   }
   panic("filewrite");
 }
 
+
+// Move up to n bytes from file in to file out, without passing
+// them through user space.  From a regular file into a pipe the
+// data goes straight from the buffer cache into the pipe; other
+// combinations go through one kernel page.  Stops at end of file,
+// or after a short read from a pipe or device.
+// Return the number of bytes moved.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  int r, w, m, tot;
+  char *page;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+
+  tot = 0;
+  if(in->type == FD_INODE && in->ip->type != T_DEV && out->type == FD_PIPE){
+    while(tot < n){
+      if(pipewaitspace(out->pipe) < 0)
+        return tot > 0 ? tot : -1;
+      ilock(in->ip);
+      if(in->off >= in->ip->size){
+        iunlock(in->ip);
+        break;
+      }
+      r = readiput(in->ip, in->off, n - tot, pipeput, out->pipe);
+      if(r > 0)
+        in->off += r;
+      iunlock(in->ip);
+      if(r < 0)
+        return tot > 0 ? tot : -1;
+      tot += r;
+    }
+    return tot;
+  }
+
+  if((page = kalloc()) == 0)
+    return -1;
+  while(tot < n){
+    m = n - tot;
+    if(m > PGSIZE)
+      m = PGSIZE;
+    if((r = fileread(in, page, m)) <= 0){
+      if(r < 0 && tot == 0)
+        tot = -1;
+      break;
+    }
+    if((w = filewrite(out, page, r)) != r){
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    tot += r;
+    if(r < m)
+      break;
+  }
+  kfree(page);
+  return tot;
+}
@@ -18,6 +18,8 @@ struct inode {
   // このinodeを参照しているCのポインタの数
   // 0になったらメモリから退去させる
   int ref;            // Reference count
+  // このinodeのプログラムを実行中のプロセス数(p->exe)．書き込みを拒否する
+  int nexec;          // References that are some p->exe; see iexec
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,8 +28,16 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  // addrs[NDIRECT]にはさらにaddrsの配列が格納されている
-  uint addrs[NDIRECT+1];
+  // indirectにはさらにextentの配列が格納されている
+  struct extent ext[NEXTENT];
+  uint indirect[NLEVEL];
+  // 最後にbmapで見つけたextentの番号と，そのextentの先頭のファイル内ブロック番号
+  uint xk;            // Index of the extent bmap found last
+  uint xfbn;          // File block number at the start of extent xk
+  // 先読みの状態
+  uint ranext;        // Block a sequential read would read next
+  uint rawin;         // Read-ahead window in blocks; 0 if not sequential
+  uint raend;         // Block after the last one read ahead
 };
 
 // table mapping major device number to
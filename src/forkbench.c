@@ -0,0 +1,56 @@
+// Process creation benchmark.
+//
+// Times NFORK rounds of fork, exit and wait, then NEXEC rounds of
+// fork, exec of a trivial program (echo with no arguments) and
+// wait.  Each fork builds a page directory and each exec another,
+// so both are dominated by how much of the kernel's address space
+// has to be set up per page directory.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NFORK  1000
+#define NEXEC  200
+
+int
+main(int argc, char *argv[])
+{
+  int i, pid;
+  uint t0, t1;
+  char *args[] = { "echo", 0 };
+
+  printf(1, "forkbench starting\n");
+
+  t0 = uptime();
+  for(i = 0; i < NFORK; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "forkbench: fork failed\n");
+      exit();
+    }
+    if(pid == 0)
+      exit();
+    wait();
+  }
+  t1 = uptime();
+  printf(1, "forkbench: %d forks in %d ticks\n", NFORK, t1 - t0);
+
+  t0 = uptime();
+  for(i = 0; i < NEXEC; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "forkbench: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      exec("echo", args);
+      printf(1, "forkbench: exec echo failed\n");
+      exit();
+    }
+    wait();
+  }
+  t1 = uptime();
+  printf(1, "forkbench: %d fork+execs in %d ticks\n", NEXEC, t1 - t0);
+  exit();
+}
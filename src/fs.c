@@ -27,14 +27,15 @@ static void itrunc(struct inode*);
 // only one device
 struct superblock sb; 
 
-// Read the super block.
+// Read the super block, at byte SBOFF of the disk in blocks of
+// the cache's current block size.
 void
 readsb(int dev, struct superblock *sb)
 {
   struct buf *bp;
 
-  bp = bread(dev, 1);
-  memmove(sb, bp->data, sizeof(*sb));
+  bp = bread(dev, SBOFF / bsize);
+  memmove(sb, bp->data + SBOFF % bsize, sizeof(*sb));
   brelse(bp);
 }
 
@@ -45,24 +46,31 @@ bzero(int dev, int bno)
   struct buf *bp;
 
   bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
+  memset(bp->data, 0, sb.bsize);
   log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Allocate a zeroed disk block: the first free one at or after
+// goal, wrapping around to the start of the disk.  Passing the block
+// after a file's last one as goal keeps the file contiguous.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal)
 {
-  int b, bi, m;
+  int b, bi, m, n;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  if(goal >= sb.size)
+    goal = 0;
+  b = goal - goal % BPB(sb);
+  bi = goal % BPB(sb);
+  // One pass more than there are bitmap blocks, for the part of
+  // goal's bitmap block before goal.
+  for(n = 0; n <= (sb.size + BPB(sb) - 1) / BPB(sb); n++){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+    for(; bi < BPB(sb) && b + bi < sb.size; bi++){
       m = 1 << (bi % 8);
       if((bp->data[bi/8] & m) == 0){  // Is block free?
         bp->data[bi/8] |= m;  // Mark block in use.
@@ -73,26 +81,37 @@ balloc(uint dev)
       }
     }
     brelse(bp);
+    bi = 0;
+    b += BPB(sb);
+    if(b >= sb.size)
+      b = 0;
   }
   panic("balloc: out of blocks");
 }
 
-// Free a disk block.
+// Free len disk blocks starting at b.
 static void
-bfree(int dev, uint b)
+bfree(int dev, uint b, uint len)
 {
   struct buf *bp;
   int bi, m;
 
-  readsb(dev, &sb);
-  bp = bread(dev, BBLOCK(b, sb));
-  bi = b % BPB;
-  m = 1 << (bi % 8);
-  if((bp->data[bi/8] & m) == 0)
-    panic("freeing free block");
-  bp->data[bi/8] &= ~m;
-  log_write(bp);
-  brelse(bp);
+  bp = 0;
+  for(; len > 0; b++, len--){
+    if(bp == 0 || b % BPB(sb) == 0){
+      if(bp)
+        brelse(bp);
+      bp = bread(dev, BBLOCK(b, sb));
+    }
+    bi = b % BPB(sb);
+    m = 1 << (bi % 8);
+    if((bp->data[bi/8] & m) == 0)
+      panic("freeing free block");
+    bp->data[bi/8] &= ~m;
+    log_write(bp);
+  }
+  if(bp)
+    brelse(bp);
 }
 
 // Inodes.
@@ -180,10 +199,11 @@ iinit(int dev)
   }
 
   readsb(dev, &sb);
+  bsetsize(sb.bsize);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
- inodestart %d bmap start %d\n", sb.size, sb.nblocks,
+ inodestart %d bmap start %d bsize %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
-          sb.bmapstart);
+          sb.bmapstart, sb.bsize);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -207,7 +227,7 @@ ialloc(uint dev, short type)
     bp = bread(dev, IBLOCK(inum, sb));
 	// bp: inodeが格納されているバッファのメタデータへのポインタ
 	// dip = 該当するinodeがある位置
-    dip = (struct dinode*)bp->data + inum%IPB;
+    dip = (struct dinode*)bp->data + inum%IPB(sb);
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
@@ -235,13 +255,14 @@ iupdate(struct inode *ip)
   struct dinode *dip;
 
   bp = bread(ip->dev, IBLOCK(ip->inum, sb));
-  dip = (struct dinode*)bp->data + ip->inum%IPB;
+  dip = (struct dinode*)bp->data + ip->inum%IPB(sb);
   dip->type = ip->type;
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  memmove(dip->ext, ip->ext, sizeof(ip->ext));
+  memmove(dip->indirect, ip->indirect, sizeof(ip->indirect));
   log_write(bp);
   brelse(bp);
 }
@@ -317,13 +338,16 @@ ilock(struct inode *ip)
 	// inodeの実体が格納されているbufferへのポインタ
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
 	// bufのどこに該当のinodeの実体のデータが存在しているか
-    dip = (struct dinode*)bp->data + ip->inum%IPB;
+    dip = (struct dinode*)bp->data + ip->inum%IPB(sb);
     ip->type = dip->type;
     ip->major = dip->major;
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    memmove(ip->ext, dip->ext, sizeof(ip->ext));
+    memmove(ip->indirect, dip->indirect, sizeof(ip->indirect));
+    ip->xk = ip->xfbn = 0;
+    ip->ranext = ip->rawin = ip->raend = 0;
     brelse(bp);
     ip->valid = 1;
     if(ip->type == 0)
@@ -386,45 +410,225 @@ iunlockput(struct inode *ip)
 //PAGEBREAK!
 // Inode content
 //
-// The content (data) associated with each inode is stored
-// in blocks on the disk. The first NDIRECT block numbers
-// are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// The content (data) associated with each inode is stored in
+// extents, runs of consecutive blocks on the disk.  A file has
+// no holes: its blocks are those of its extents, in order.  The
+// extents are numbered from 0 and kept in slots:
+//   the first NEXTENT are in ip->ext[];
+//   the next NXINDIRECT are in block ip->indirect[0];
+//   the next NINDIRECT*NXINDIRECT are in the blocks listed in
+//   block ip->indirect[1];
+//   and the next NINDIRECT*NINDIRECT*NXINDIRECT one level further
+//   down from ip->indirect[2].
+// A sequential read or write looks at one block of extents per
+// NXINDIRECT extents, not at a block of block numbers per block.
+
+// Return a pointer to extent slot k of inode ip.  If the slot is
+// in an indirect block, return the locked buffer holding it in
+// *bpp; the caller must brelse it.  If alloc is set, allocate the
+// indirect blocks on the way, near block goal; otherwise return 0
+// if one is missing.  Return 0 if k is past the last slot.
+static struct extent*
+xslot(struct inode *ip, uint k, int alloc, uint goal, struct buf **bpp)
+{
+  uint *a, span, addr;
+  int level;
+  struct buf *bp;
+
+  *bpp = 0;
+  if(k < NEXTENT)
+    return &ip->ext[k];
+  k -= NEXTENT;
+
+  // どのレベルのindirectブロックの下にあるか
+  span = NXINDIRECT(sb);  // slots below one block at this level
+  for(level = 0; level < NLEVEL; level++){
+    if(k < span)
+      break;
+    k -= span;
+    span *= NINDIRECT(sb);
+  }
+  if(level == NLEVEL)
+    return 0;
+
+  a = &ip->indirect[level];
+  bp = 0;
+  for(;;){
+    if((addr = *a) == 0){
+      if(!alloc){
+        if(bp)
+          brelse(bp);
+        return 0;
+      }
+      // ip->indirect[]は呼び出し側がiupdateする
+      addr = *a = balloc(ip->dev, goal);
+      if(bp)
+        log_write(bp);
+    }
+    if(bp)
+      brelse(bp);
+    bp = bread(ip->dev, addr);
+    if(span == NXINDIRECT(sb))
+      break;
+    span /= NINDIRECT(sb);
+    a = (uint*)bp->data + k / span;
+    k %= span;
+  }
+  *bpp = bp;
+  return (struct extent*)bp->data + k;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bn must be the block just after
+// the file's last one, and bmap allocates it: it grows the last
+// extent if the disk block after it is free, else starts a new
+// extent.  Return 0 if the file has run out of extent slots.
 // readi, writeiが該当のディスクに楽にアクセスできるようにするhelper
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint k, fbn, addr, goal;
   struct buf *bp;
-
-  // indirectテーブルを見なくてもいい
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
-    return addr;
+  struct extent *x;
+
+  // Extents only ever get appended, so the one found last time
+  // is still at the same place; sequential access starts there.
+  k = 0;
+  fbn = 0;
+  if(bn >= ip->xfbn){
+    k = ip->xk;
+    fbn = ip->xfbn;
+  }
+  // 先頭からextentの長さを足していき，bnを含むextentを探す
+  for(;; k++){
+    if((x = xslot(ip, k, 0, 0, &bp)) == 0 || x->len == 0)
+      break;
+    if(bn < fbn + x->len){
+      addr = x->start + bn - fbn;
+      if(bp)
+        brelse(bp);
+      ip->xk = k;
+      ip->xfbn = fbn;
+      return addr;
+    }
+    fbn += x->len;
+    if(bp)
+      brelse(bp);
   }
-  // indirectテーブルを見に行く
-  bn -= NDIRECT;
+  if(bp)
+    brelse(bp);
+  if(bn != fbn)
+    panic("bmap: hole");
+  bp = 0;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-	// inodeのデータ配列の先頭
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
+  // 最後のextentの直後のブロックが空いていればextentを伸ばす
+  goal = 0;
+  x = 0;
+  if(k > 0){
+    x = xslot(ip, k - 1, 0, 0, &bp);
+    goal = x->start + x->len;
+  }
+  addr = balloc(ip->dev, goal);
+  if(x && addr == goal){
+    x->len++;
+  } else {
+    if(bp)
+      brelse(bp);
+    if((x = xslot(ip, k, 1, addr, &bp)) == 0){
+      // Out of extent slots.
+      bfree(ip->dev, addr, 1);
+      return 0;
     }
+    x->start = addr;
+    x->len = 1;
+    ip->xk = k;
+    ip->xfbn = fbn;
+  }
+  if(bp){
+    log_write(bp);
     brelse(bp);
-    return addr;
   }
+  return addr;
+}
 
-  panic("bmap: out of range");
+// Free extent *x from its end, the blocks under one bitmap block
+// at a time, while *room says the transaction can log another
+// bitmap block.  Return 0 if it ran out of room first.
+static int
+xtrim(struct inode *ip, struct extent *x, int *room)
+{
+  uint end, n;
+
+  while(x->len > 0){
+    if(*room < 1)
+      return 0;
+    end = x->start + x->len;
+    n = (end - 1) % BPB(sb) + 1;
+    if(n > x->len)
+      n = x->len;
+    bfree(ip->dev, end - n, n);
+    x->len -= n;
+    *room -= 1;
+  }
+  x->start = 0;
+  return 1;
+}
+
+// Free the extents below *ap, an indirect block of the given
+// level (0: a block of extents), last first, and then the block
+// itself, clearing *ap.  Each entry is cleared as its blocks are
+// freed, so a later call picks up where one that ran out of room
+// stopped.  The caller has counted the block holding *ap.
+static int
+xfree(struct inode *ip, uint *ap, int level, int *room)
+{
+  int i, r;
+  struct buf *bp;
+  struct extent *x;
+  uint *a;
+
+  if(*room < 2)
+    return 0;
+  *room -= 1;  // this block
+  r = *room;
+  bp = bread(ip->dev, *ap);
+  if(level == 0){
+    x = (struct extent*)bp->data;
+    for(i = NXINDIRECT(sb) - 1; i >= 0; i--)
+      if(!xtrim(ip, &x[i], room))
+        break;
+  } else {
+    a = (uint*)bp->data;
+    for(i = NINDIRECT(sb) - 1; i >= 0; i--)
+      if(a[i] && !xfree(ip, &a[i], level - 1, room))
+        break;
+  }
+  if(*room < r)
+    log_write(bp);
+  brelse(bp);
+  if(i >= 0 || *room < 1)
+    return 0;
+  bfree(ip->dev, *ap, 1);
+  *ap = 0;
+  *room -= 1;
+  return 1;
+}
+
+// Free as much of ip's content as one transaction can log,
+// from the end of the file.  Return 1 once nothing is left.
+static int
+itrunc1(struct inode *ip)
+{
+  int i, room;
+
+  room = MAXOPBLOCKS - 1;  // the inode's own block
+  for(i = NLEVEL - 1; i >= 0; i--)
+    if(ip->indirect[i] && !xfree(ip, &ip->indirect[i], i, &room))
+      return 0;
+  for(i = NEXTENT - 1; i >= 0; i--)
+    if(!xtrim(ip, &ip->ext[i], &room))
+      return 0;
+  return 1;
 }
 
 // Truncate inode (discard contents).
@@ -432,33 +636,19 @@ bmap(struct inode *ip, uint bn)
 // to it (no directory entries referring to it)
 // and has no in-memory reference to it (is
 // not an open file or current directory).
+// Every bfree logs a bitmap block, so a large file is freed over
+// several transactions: the caller's, and new ones begun here.
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
-
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
-  }
-
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
-  }
-
+  ip->xk = ip->xfbn = 0;
+  ip->ranext = ip->rawin = ip->raend = 0;
   ip->size = 0;
+  while(!itrunc1(ip)){
+    iupdate(ip);
+    end_op();
+    begin_op();
+  }
   iupdate(ip);
 }
 
@@ -474,7 +664,103 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Mark a reference to ip as that of a process running the program
+// in it (p->exe).  pagein() reads the program's text and data from
+// ip on demand, so writei refuses to change ip while any such
+// reference remains.  exec calls this with ip locked, so that no
+// write is in progress; fork, with the parent's reference held.
+void
+iexec(struct inode *ip)
+{
+  acquire(&icache.lock);
+  ip->nexec++;
+  release(&icache.lock);
+}
+
+// Drop a reference marked by iexec.
+// Like iput, must be called inside a transaction.
+void
+iputexec(struct inode *ip)
+{
+  acquire(&icache.lock);
+  ip->nexec--;
+  release(&icache.lock);
+  iput(ip);
+}
+
 //PAGEBREAK!
+// Read-ahead.  A read that starts at the block where the previous
+// one on the inode ended, or in the last block of that one, is
+// sequential.  The window then doubles,
+// from RAMIN up to RAMAX blocks; any other read closes it.  Before
+// waiting for each block it needs, a sequential read starts reading
+// the window's worth from that block on, all at once so that the
+// disk merges them into few commands; later reads then find their
+// blocks in the cache or already on the way.  To start each batch
+// early but not on every block, a new one is started when less than
+// half a window is left ahead of the reader.
+#define RAMIN 4
+#define RAMAX 32
+
+// A read starting at block bn of ip is about to start: open,
+// grow or close the read-ahead window.
+// Caller must hold ip->lock.
+static void
+rawindow(struct inode *ip, uint bn)
+{
+  if(bn + 1 == ip->ranext && ip->rawin){
+    // Still in the block where the last read ended.
+  } else if(bn == ip->ranext){
+    if(ip->rawin == 0)
+      ip->rawin = RAMIN;
+    else if(ip->rawin < RAMAX)
+      ip->rawin *= 2;
+  } else {
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+}
+
+// The read is about to wait for block bn of ip.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint bn)
+{
+  uint b, end, xk, xfbn, i, n;
+  uint addr[RAMAX];
+
+  if(ip->rawin == 0 || ip->raend >= bn + ip->rawin/2)
+    return;
+
+  end = bn + ip->rawin;
+  if(end > (ip->size + sb.bsize - 1) / sb.bsize)
+    end = (ip->size + sb.bsize - 1) / sb.bsize;
+  b = bn > ip->raend ? bn : ip->raend;
+  if(b >= end)
+    return;
+
+  // Mapping the blocks ahead moves bmap's extent cache past bn;
+  // put it back for the reads that follow.
+  // bmap may have to read an indirect extent block, and must not
+  // wait for it while the disk is plugged: map the batch first.
+  bmap(ip, bn);
+  xk = ip->xk;
+  xfbn = ip->xfbn;
+  for(n = 0; b + n < end; n++)
+    addr[n] = bmap(ip, b + n);
+  ip->xk = xk;
+  ip->xfbn = xfbn;
+
+  // Blocks breadahead refuses are left to the reader, and to
+  // the next batch.
+  ideplug();
+  for(i = 0; i < n; i++)
+    if(!breadahead(ip->dev, addr[i]))
+      break;
+  ideunplug();
+  ip->raend = b + i;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 int
@@ -493,23 +779,68 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     return -1;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(n > 0)
+    rawindow(ip, off/sb.bsize);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(dst, bp->data + off%BSIZE, m);
+    readahead(ip, off/sb.bsize);
+    bp = bread(ip->dev, bmap(ip, off/sb.bsize));
+    m = min(n - tot, sb.bsize - off%sb.bsize);
+    memmove(dst, bp->data + off%sb.bsize, m);
     brelse(bp);
   }
+  if(tot > 0)
+    ip->ranext = (off - 1)/sb.bsize + 1;
   return n;
 }
 
+// Read data from inode like readi, but instead of copying it
+// to dst, offer it to put(arg, src, len) straight from the
+// buffer cache.  put must not sleep; it returns how much it took,
+// and reading stops when it takes less than offered.
+// Return the number of bytes taken.
+// Caller must hold ip->lock.
+int
+readiput(struct inode *ip, uint off, uint n,
+         int (*put)(void*, char*, int), void *arg)
+{
+  uint tot, m, r;
+  struct buf *bp;
+
+  if(ip->type == T_DEV)
+    return -1;
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(off + n > ip->size)
+    n = ip->size - off;
+  if(n > 0)
+    rawindow(ip, off/sb.bsize);
+
+  for(tot=0; tot<n; tot+=r, off+=r){
+    readahead(ip, off/sb.bsize);
+    bp = bread(ip->dev, bmap(ip, off/sb.bsize));
+    m = min(n - tot, sb.bsize - off%sb.bsize);
+    r = put(arg, (char*)bp->data + off%sb.bsize, m);
+    brelse(bp);
+    if(r < m){
+      tot += r;
+      off += r;
+      break;
+    }
+  }
+  // Only what put took was read; the rest is read again next time.
+  if(tot > 0)
+    ip->ranext = (off - 1)/sb.bsize + 1;
+  return tot;
+}
+
 // PAGEBREAK!
 // Write data to inode.
 // Caller must hold ip->lock.
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -520,22 +851,27 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(off + n > MAXFILESIZE)
+    return -1;
+  // A running program; see iexec.
+  if(ip->nexec > 0)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(bp->data + off%BSIZE, src, m);
+    if((addr = bmap(ip, off/sb.bsize)) == 0)
+      break;  // file too fragmented
+    bp = bread(ip->dev, addr);
+    m = min(n - tot, sb.bsize - off%sb.bsize);
+    memmove(bp->data + off%sb.bsize, src, m);
     log_write(bp);
     brelse(bp);
   }
 
-  if(n > 0 && off > ip->size){
+  if(tot > 0 && off > ip->size){
     ip->size = off;
     iupdate(ip);
   }
-  return n;
+  return tot;
 }
 
 //PAGEBREAK!
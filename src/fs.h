@@ -3,12 +3,18 @@
 
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#define BSIZE 512  // smallest and default block size
+#define MAXBSIZE 4096  // largest block size (at most a page)
+#define SBOFF 512  // byte offset of the super block on the disk
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
 //                                          free bit map | data blocks]
 //
+// The block size is a power of two from BSIZE to MAXBSIZE, chosen
+// by mkfs.  The super block is always at byte SBOFF, so it can be
+// read before the block size is known: it is block 1 if blocks
+// are BSIZE bytes, else it shares block 0 with the boot block.
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
 struct superblock {
@@ -19,12 +25,28 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint bsize;        // Block size (bytes)
 };
 
-#define NDIRECT 12
-// バッファへのポインタの配列
-#define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+// A file's data is kept in extents: runs of consecutive disk
+// blocks holding consecutive blocks of the file.
+struct extent {
+  uint start;           // First disk block
+  uint len;             // Number of blocks; 0 if the slot is unused
+};
+
+// 連続したブロックの範囲(extent)の配列
+#define NEXTENT 5
+// Extents in an indirect extent block
+#define NXINDIRECT(sb) ((sb).bsize / sizeof(struct extent))
+// Block numbers in a doubly- or triply-indirect block
+#define NINDIRECT(sb)  ((sb).bsize / sizeof(uint))
+// Levels of indirection: singly, doubly and triply indirect
+#define NLEVEL 3
+// Largest file in bytes, so that its size fits in an int.
+// How many blocks fit in the extents depends on how contiguous
+// the free space is.
+#define MAXFILESIZE 0x80000000U
 
 // On-disk inode structure
 // ディスク上のinodeの構造
@@ -36,23 +58,26 @@ struct dinode {
   // このinodeを参照しているディレクトリの数(hardlinkではnlinkが増加, symbliclinkでは増加しない)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  // このinodeの実体ブロックへのアドレスの配列
-  uint addrs[NDIRECT+1];   // Data block addresses
+  // このinodeの実体ブロックの範囲
+  struct extent ext[NEXTENT];  // First extents of the file
+  // indirect[0]: block of extents, indirect[1]: block of numbers
+  // of such blocks, indirect[2]: block of numbers of indirect[1]-like blocks
+  uint indirect[NLEVEL];  // Singly, doubly and triply indirect blocks
 };
 
 // Inodes per block.
 // バッファにいくつのinodeが入るか
-#define IPB           (BSIZE / sizeof(struct dinode))
+#define IPB(sb)       ((sb).bsize / sizeof(struct dinode))
 
 // Block containing inode i
 // inode iが格納されているbufferのblock no
-#define IBLOCK(i, sb)     ((i) / IPB + sb.inodestart)
+#define IBLOCK(i, sb)     ((i) / IPB(sb) + sb.inodestart)
 
 // Bitmap bits per block
-#define BPB           (BSIZE*8)
+#define BPB(sb)       ((sb).bsize*8)
 
 // Block of free map containing bit for block b
-#define BBLOCK(b, sb) (b/BPB + sb.bmapstart)
+#define BBLOCK(b, sb) (b/BPB(sb) + sb.bmapstart)
 
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
@@ -23,16 +23,40 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
+// Sectors per interrupt set for READ/WRITE MULTIPLE.
+#define IDE_MULT      16
+// Most sectors moved by one command.  Requests for adjacent blocks
+// are merged up to this size; the data then moves IDE_MULT sectors
+// per interrupt.
+#define IDE_MAXSECT   64
+// A request that has waited this many ticks is served next,
+// whatever its position, so that seeks cannot starve it.
+#define IDE_DEADLINE  10
+
+// idequeue holds the bufs waiting for the disk, oldest first;
+// new ones are appended at idetail.  ideactive[] holds the bufs
+// the disk is now reading/writing with a single command, in
+// block order; idensect sectors in all, of which idedone have
+// been moved through the data port.  idehead is the block just
+// after that command, the position from which the next request
+// is chosen.  While ideplugged is set, new requests only queue,
+// so a batch can be sorted and merged before the disk starts.
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static struct buf *idetail;
+static struct buf *ideactive[IDE_MAXSECT];
+static int nactive;
+static int idensect;
+static int idedone;
+static uint idehead;
+static int ideplugged;
 
 static int havedisk1;
-static void idestart(struct buf*);
+static void idestart(void);
 
 // Wait for IDE disk to become ready.
 static int
@@ -48,6 +72,17 @@ idewait(int checkerr)
   return 0;
 }
 
+// Let disk transfer IDE_MULT sectors per interrupt
+// with READ/WRITE MULTIPLE.
+static void
+idesetmul(int disk)
+{
+  outb(0x1f6, 0xe0 | (disk<<4));
+  outb(0x1f2, IDE_MULT);
+  outb(0x1f7, IDE_CMD_SETMUL);
+  idewait(0);  // reading the status also clears the interrupt
+}
+
 // IDE: Integrated Device Electronics
 // I/Oインタフェース
 // I/O APICのIDE割り込みを有効化
@@ -74,28 +109,120 @@ ideinit(void)
     }
   }
 
+  if(havedisk1)
+    idesetmul(1);
+  idesetmul(0);
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Remove b from idequeue.  Caller must hold idelock.
+static void
+ideunlink(struct buf *b)
+{
+  struct buf **pp, *prev;
+
+  prev = 0;
+  for(pp = &idequeue; *pp != b; pp = &(*pp)->qnext)
+    prev = *pp;
+  *pp = b->qnext;
+  if(idetail == b)
+    idetail = prev;
+}
+
+// Choose the next request: the oldest one if it has waited
+// IDE_DEADLINE ticks, otherwise the lowest block at or after
+// idehead, wrapping around to the lowest block (C-LOOK).
+// Caller must hold idelock; idequeue must not be empty.
+static struct buf*
+idepick(void)
+{
+  struct buf *b, *up, *low;
+
+  if(ticks - idequeue->qtime >= IDE_DEADLINE)
+    return idequeue;
+  up = low = 0;
+  for(b = idequeue; b; b = b->qnext){
+    if(b->blockno >= idehead && (up == 0 || b->blockno < up->blockno))
+      up = b;
+    if(low == 0 || b->blockno < low->blockno)
+      low = b;
+  }
+  return up ? up : low;
+}
+
+// Find a queued request that can extend the command ending
+// with b.  Caller must hold idelock.
+static struct buf*
+idenext(struct buf *b)
+{
+  struct buf *n;
+
+  for(n = idequeue; n; n = n->qnext)
+    if(n->dev == b->dev && n->blockno == b->blockno + 1 &&
+       (n->flags & B_DIRTY) == (b->flags & B_DIRTY))
+      return n;
+  return 0;
+}
+
+// Move the next chunk of the active command, at most IDE_MULT
+// sectors, through the data port.  Caller must hold idelock.
+static void
+idexfer(void)
+{
+  struct buf *b;
+  int n, sector_per_block = bsize/SECTOR_SIZE;
+
+  n = idensect - idedone;
+  if(n > IDE_MULT)
+    n = IDE_MULT;
+  for(; n > 0; n--, idedone++){
+    b = ideactive[idedone / sector_per_block];
+    if(b->flags & B_DIRTY)
+      outsl(0x1f0, b->data + (idedone % sector_per_block)*SECTOR_SIZE, SECTOR_SIZE/4);
+    else
+      insl(0x1f0, b->data + (idedone % sector_per_block)*SECTOR_SIZE, SECTOR_SIZE/4);
+  }
+}
+
+// Start the disk on the next request(s) in idequeue,
+// merging requests for adjacent blocks into one command.
+// Caller must hold idelock.
 static void
-idestart(struct buf *b)
+idestart(void)
 {
-  if(b == 0)
+  struct buf *b, *n;
+  int i;
+  int sector_per_block =  bsize/SECTOR_SIZE;
+  int maxblocks = IDE_MAXSECT / sector_per_block;
+
+  if(idequeue == 0 || nactive != 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
-    panic("incorrect blockno");
-  int sector_per_block =  BSIZE/SECTOR_SIZE;
-  int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  if (sector_per_block > IDE_MAXSECT) panic("idestart");
 
-  if (sector_per_block > 7) panic("idestart");
+  b = idepick();
+  ideunlink(b);
+  ideactive[0] = b;
+  nactive = 1;
+  while(nactive < maxblocks && (n = idenext(ideactive[nactive-1])) != 0){
+    ideunlink(n);
+    ideactive[nactive++] = n;
+  }
+  idehead = ideactive[nactive-1]->blockno + 1;
+
+  for(i = 0; i < nactive; i++)
+    if(ideactive[i]->blockno >= FSSIZE)
+      panic("incorrect blockno");
+  int sector = b->blockno * sector_per_block;
+  idensect = nactive * sector_per_block;
+  idedone = 0;
+  int read_cmd = (idensect == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
+  int write_cmd = (idensect == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, idensect);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
@@ -103,10 +230,9 @@ idestart(struct buf *b)
   if(b->flags & B_DIRTY){
 	// 書き込み
     outb(0x1f7, write_cmd);
-	// TBC: 何をしている?
-	// bufの中のデータの1/4をどこかに渡している
-	// write命令を行うことをportにセットし，書き込みデータを指定の場所に送っている？
-    outsl(0x1f0, b->data, BSIZE/4);
+	// 書き込むデータを4byteずつデータポート(0x1f0)に送る
+	// 残りは割り込みごとにideintrが送る
+    idexfer();
   } else {
     outb(0x1f7, read_cmd);
   }
@@ -114,49 +240,92 @@ idestart(struct buf *b)
 
 // Interrupt handler.
 // ideからの割り込みがあった際に呼び出される
-// idequeueの先頭が処理されたことを意味し、先頭からbufを取り除き、
-// そのbufをchanとして待つプロセスをSLEEPINGからRUNNABLEに変える
+// 一回の割り込みでIDE_MULTセクタ分の転送が終わる
+// コマンド全体が完了したらideactiveのbufをchanとして待つプロセスを
+// SLEEPINGからRUNNABLEに変える
 void
 ideintr(void)
 {
   struct buf *b;
+  int i;
 
-  // First queued buffer is the active request.
+  // ideactive holds the request(s) of the running command.
   acquire(&idelock);
 
-  if((b = idequeue) == 0){
+  if(nactive == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(ideactive[0]->flags & B_DIRTY){
+    // The disk took the last chunk; send the next one, if any.
+    if(idedone < idensect){
+      idexfer();
+      release(&idelock);
+      return;
+    }
+  } else if(idewait(1) >= 0){
+    // Read data of this chunk; more interrupts follow if
+    // the command is longer.
+    idexfer();
+    if(idedone < idensect){
+      release(&idelock);
+      return;
+    }
+  }
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  // Wake processes waiting for these bufs.
+  for(i = 0; i < nactive; i++){
+    b = ideactive[i];
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    wakeup(b);
+    if(b->flags & B_ASYNC)
+      bdone(b);
+  }
+  nactive = 0;
 
   // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  if(idequeue != 0 && !ideplugged)
+    idestart();
 
   release(&idelock);
 }
 
+// Hold back the disk while a batch of requests is queued
+// with idesubmit, so that idestart sees the whole batch and
+// can merge it into as few commands as possible.
+// Must be followed by ideunplug before waiting on the batch.
+void
+ideplug(void)
+{
+  acquire(&idelock);
+  ideplugged++;
+  release(&idelock);
+}
+
+// Let the disk start on requests queued since ideplug.
+void
+ideunplug(void)
+{
+  acquire(&idelock);
+  if(ideplugged <= 0)
+    panic("ideunplug");
+  ideplugged--;
+  if(!ideplugged && nactive == 0 && idequeue != 0)
+    idestart();
+  release(&idelock);
+}
+
 //PAGEBREAK!
-// Sync buf with disk.
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
-// 対象のバッファを処理する
+// Queue b for the disk and return without waiting.
+// If B_DIRTY is set, write buf to disk, else read it.
+// b must stay locked until ideawait(b) returns.
+// 対象のバッファをキューにつなぐ
 // リストの操作はクリティカルセクションであるため、ロックで保護する
 void
-iderw(struct buf *b)
+idesubmit(struct buf *b)
 {
-  struct buf **pp;
-
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
@@ -164,31 +333,48 @@ iderw(struct buf *b)
   if(b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
 
-  // sleepを実行するまえにロックを獲得する
-  // 条件を調べて，スリープに入る前にwakeupが実行されないように
-  // ideintrでもidelockを獲得しているはず
   acquire(&idelock);  //DOC:acquire-lock
 
   // Append b to idequeue.
-  // idequeueの末尾にバッファを追加
+  // idequeueの末尾にバッファを追加(O(1))
   b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
+  b->qtime = ticks;
+  if(idetail)
+    idetail->qnext = b;
+  else
+    idequeue = b;
+  idetail = b;
 
-  // 対象のバッファがリストの先頭であった場合，idestartを送る必要がある
+  // ディスクが止まっていればidestartを送る必要がある
   // Start disk if necessary.
-  if(idequeue == b)
-	// diskの処理開始, 終わったら割り込みを入れてくる？
-    idestart(b);
+  if(nactive == 0 && !ideplugged)
+    idestart();
 
-  // acquireでpopcli
+  release(&idelock);
+}
+
+// Wait for a request queued by idesubmit to finish.
+void
+ideawait(struct buf *b)
+{
+  // sleepを実行するまえにロックを獲得する
+  // 条件を調べて，スリープに入る前にwakeupが実行されないように
+  // ideintrでもidelockを獲得しているはず
+  acquire(&idelock);
   // Wait for request to finish.
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
 	// diskの処理が完了したら，ioapic経由でdiskから割り込みが発生する(ideintr)
     sleep(b, &idelock);
   }
-
-
   release(&idelock);
 }
+
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  idesubmit(b);
+  ideawait(b);
+}
@@ -7,9 +7,12 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
 
 void freerange(void *vstart, void *vend);
+struct kmemcpu;
+static void kpush(struct kmemcpu*, char*);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 				   // 物理メモリのロードされたカーネルの終端
@@ -19,13 +22,31 @@ struct run {
   struct run *next;
 };
 
+// Max pages moved from another CPU's list by one steal.
+#define KSTEAL 32
+
 // カーネルが割り当てる物理メモリの候補となるアドレスのポインタ
-// kallocにおいてfreelistの先頭のrunを割り当てられる物理ページとして返す
+// Each CPU has its own free list and lock, so kalloc/kfree on
+// different CPUs do not contend.  A CPU whose list runs dry steals
+// a batch of pages from another CPU's list.
 // freelistはspinlockで守られている
-struct {
+struct kmemcpu {
   struct spinlock lock;
-  int use_lock;
   struct run *freelist;
+  uint nfree;       // pages on freelist
+  // Statistics, printed by kmemdump.
+  uint hits;        // kalloc served from this CPU's list
+  uint misses;      // kalloc found this CPU's list empty
+  uint steals;      // pages taken from other CPUs' lists
+} __attribute__((__aligned__(64)));  // keep CPUs off each other's cache lines
+
+struct {
+  int use_lock;
+  struct kmemcpu cpu[NCPU];
+  // Number of page tables mapping each physical page, for
+  // copy-on-write fork.  kfree only frees a page when this drops
+  // to zero.  Updated with atomic instructions, not a lock.
+  ushort ref[PHYSTOP/PGSIZE];
 } kmem;
 
 // Initialization happens in two phases.
@@ -35,18 +56,32 @@ struct {
 // after installing a full page table that maps them on all cores.
 // 物理アドレスのendから4MBまでの領域をカーネルのフリーリストとして初期化する
 // entrypgdirは[KERNBASE, KERNBASE+4MB]を[0, 4MB]と対応づけているため、mainの冒頭では4MBまでしか使えない
+// Before kinit2 there is only one CPU running and mycpu() does not
+// work yet (mpinit has not run), so everything goes to cpu[0]'s list.
 void
 kinit1(void *vstart, void *vend)
 {
-  initlock(&kmem.lock, "kmem");
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmem.cpu[i].lock, "kmem");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
 
+// Spread the remaining pages over all CPUs' lists so that
+// they do not all have to be stolen from the boot CPU.
 void
 kinit2(void *vstart, void *vend)
 {
-  freerange(vstart, vend);
+  char *p;
+  int i;
+
+  p = (char*)PGROUNDUP((uint)vstart);
+  for(i = 0; p + PGSIZE <= (char*)vend; p += PGSIZE, i++){
+    memset(p, 1, PGSIZE);
+    kpush(&kmem.cpu[i % ncpu], p);
+  }
   kmem.use_lock = 1;
 }
 
@@ -57,11 +92,30 @@ freerange(void *vstart, void *vend)
   char *p;
   // PGROUNDUP: オフセットの切り上げ
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
 	// 1ページ分の領域を解放し、カーネルのフリーリストにつなげる
 	// 初期化におけるkfreeは、まだ獲得していない物理アドレス空間をフリーリストにつなぐこととなるため、本来の意図とは反している
+    kmem.ref[V2P(p) / PGSIZE] = 1;
     kfree(p);
+  }
 }
+
+// Return the free list of the CPU we are running on.
+// We may be rescheduled right after, which is harmless:
+// the list is still protected by its own lock.
+static struct kmemcpu*
+mykmem(void)
+{
+  struct kmemcpu *km;
+
+  if(!kmem.use_lock)
+    return &kmem.cpu[0];
+  pushcli();
+  km = &kmem.cpu[cpuid()];
+  popcli();
+  return km;
+}
+
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
@@ -71,44 +125,166 @@ freerange(void *vstart, void *vend)
 void
 kfree(char *v)
 {
-  struct run *r;
+  struct kmemcpu *km;
 
   // vがページの先頭か
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  // Still mapped by another page table (copy-on-write).
+  if(__sync_sub_and_fetch(&kmem.ref[V2P(v) / PGSIZE], 1) > 0)
+    return;
+
   // Fill with junk to catch dangling refs.
   // 1詰めして、メモリを破壊する(解放前の情報を残すと,dangling pointerによって誤作動する可能性がある)
   memset(v, 1, PGSIZE);
 
+  km = mykmem();
+  if(kmem.use_lock)
+    acquire(&km->lock);
+  kpush(km, v);
   if(kmem.use_lock)
-    acquire(&kmem.lock);
+    release(&km->lock);
+}
+
+// Put page v on km's free list.  Caller holds km->lock if needed.
+static void
+kpush(struct kmemcpu *km, char *v)
+{
+  struct run *r;
+
   // 空いた領域をrun構造体でキャスト
   r = (struct run*)v;
-  // rをkmem.freelistの先頭につなげる
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  // rをフリーリストの先頭につなげる
+  r->next = km->freelist;
+  km->freelist = r;
+  km->nfree++;
+}
+
+// Move up to KSTEAL pages from another CPU's list to km's.
+// Only one list lock is held at a time, so two CPUs stealing
+// from each other cannot deadlock.
+// Returns the number of pages stolen.
+static int
+ksteal(struct kmemcpu *km)
+{
+  struct kmemcpu *victim;
+  struct run *first, *last;
+  int i, j, n;
+
+  for(i = 1; i < ncpu; i++){
+    victim = &kmem.cpu[(km - kmem.cpu + i) % ncpu];
+    if(victim->nfree == 0)  // racy peek, rechecked under the lock
+      continue;
+    acquire(&victim->lock);
+    // take half of the victim's pages, at most KSTEAL
+    n = (victim->nfree + 1) / 2;
+    if(n > KSTEAL)
+      n = KSTEAL;
+    first = last = victim->freelist;
+    if(first == 0){
+      release(&victim->lock);
+      continue;
+    }
+    for(j = 1; j < n; j++)
+      last = last->next;
+    victim->freelist = last->next;
+    victim->nfree -= n;
+    release(&victim->lock);
+
+    acquire(&km->lock);
+    last->next = km->freelist;
+    km->freelist = first;
+    km->nfree += n;
+    km->steals += n;
+    release(&km->lock);
+    return n;
+  }
+  return 0;
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
 // 1ページ分(4096byte)の物理メモリを確保し、そのアドレスを返す
-// kmemのフリーリストの先頭を返す
+// 自CPUのフリーリストの先頭を返す．空なら他のCPUから盗む
 char*
 kalloc(void)
 {
   struct run *r;
+  struct kmemcpu *km;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
-  return (char*)r;
+  km = mykmem();
+  if(!kmem.use_lock){
+    r = km->freelist;
+    if(r){
+      km->freelist = r->next;
+      km->nfree--;
+      kmem.ref[V2P(r) / PGSIZE] = 1;
+    }
+    return (char*)r;
+  }
+
+  for(;;){
+    acquire(&km->lock);
+    r = km->freelist;
+    if(r){
+      km->freelist = r->next;
+      km->nfree--;
+      km->hits++;
+      release(&km->lock);
+      kmem.ref[V2P(r) / PGSIZE] = 1;
+      return (char*)r;
+    }
+    km->misses++;
+    release(&km->lock);
+    if(ksteal(km) == 0)
+      return 0;
+  }
+}
+
+// Record one more page table mapping the page at v.
+void
+kincref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kincref");
+  __sync_add_and_fetch(&kmem.ref[V2P(v) / PGSIZE], 1);
 }
 
+// Drop a reference to the page at v, unless it is the last one.
+// Return the number of references left; if that would be 0,
+// return 0 with the caller's reference kept, for it to kfree(v)
+// once it has finished with the page.
+int
+kunref(char *v)
+{
+  int n;
+
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kunref");
+  if((n = __sync_sub_and_fetch(&kmem.ref[V2P(v) / PGSIZE], 1)) == 0)
+    kmem.ref[V2P(v) / PGSIZE] = 1;  // no one else has it
+  return n;
+}
+
+// Return the number of page tables mapping the page at v.
+int
+krefcnt(char *v)
+{
+  return kmem.ref[V2P(v) / PGSIZE];
+}
+
+// Print per-CPU free list statistics to the console.
+// Runs when user types ^K on console.
+// No lock, like procdump.
+void
+kmemdump(void)
+{
+  struct kmemcpu *km;
+
+  for(km = kmem.cpu; km < &kmem.cpu[ncpu]; km++)
+    cprintf("cpu%d: free %d hits %d misses %d steals %d\n",
+            (int)(km - kmem.cpu), km->nfree, km->hits, km->misses,
+            km->steals);
+}
@@ -32,6 +32,7 @@
 #define TIMER   (0x0320/4)   // Local Vector Table 0 (TIMER)
   #define X1         0x0000000B   // divide counts by 1
   #define PERIODIC   0x00020000   // Periodic
+  #define ONESHOT    0x00000000   // One-shot
 #define PCINT   (0x0340/4)   // Performance Counter LVT
 #define LINT0   (0x0350/4)   // Local Vector Table 1 (LINT0)
 #define LINT1   (0x0360/4)   // Local Vector Table 2 (LINT1)
@@ -46,6 +47,11 @@
 // volatile: lapicに関する処理をコンパイラの最適化の対象外とする
 volatile uint *lapic;  // Initialized in mp.c
 
+// Timer counts per clock tick, and time-stamp counter
+// cycles per tick, measured against it in lapicinit.
+#define TICKCOUNT 10000000
+uint tscpertick;
+
 //PAGEBREAK!
 // TBC: LAPIC WRITE? indexに対応したものにvalueを割り当てる
 // indexでレジスタを指定
@@ -68,12 +74,21 @@ lapicinit(void)
 
   // The timer repeatedly counts down at bus frequency
   // from lapic[TICR] and then issues an interrupt.
-  // If xv6 cared more about precise timekeeping,
-  // TICR would be calibrated using an external time source.
+  // A tick is TICKCOUNT timer counts.  The first CPU here
+  // times a tenth of a tick with the time-stamp counter,
+  // which timer.c uses to keep time between interrupts.
   lapicw(TDCR, X1);
+  if(tscpertick == 0){
+    uint64 t0;
+    lapicw(TIMER, MASKED | ONESHOT | (T_IRQ0 + IRQ_TIMER));
+    lapicw(TICR, 0xFFFFFFFF);
+    t0 = rdtsc();
+    while(lapic[TCCR] > 0xFFFFFFFF - TICKCOUNT/10)
+      ;
+    tscpertick = (uint)(rdtsc() - t0) * 10;
+  }
   // LAPICに対して，T_IRQ0に対してTIMER割り込みを周期的に発生させるように指定
-  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000);
+  lapicperiodic();
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -133,6 +148,41 @@ microdelay(int us)
 {
 }
 
+// Have this CPU's timer interrupt every tick.
+void
+lapicperiodic(void)
+{
+  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
+  lapicw(TICR, TICKCOUNT);
+}
+
+// Have this CPU's timer interrupt once, n ticks after the start of
+// the current tick, which began d time-stamp counter cycles ago,
+// and not again until it is reprogrammed.
+void
+lapiconeshot(uint n, uint d)
+{
+  uint count;
+
+  if(n > 0xFFFFFFFF / TICKCOUNT)
+    n = 0xFFFFFFFF / TICKCOUNT;
+  if(d >= tscpertick)
+    d = tscpertick - 1;
+  count = n * TICKCOUNT - muldiv(d, TICKCOUNT, tscpertick);
+  lapicw(TIMER, ONESHOT | (T_IRQ0 + IRQ_TIMER));
+  lapicw(TICR, count ? count : 1);
+}
+
+// Send interrupt vector to the CPU with the given APIC ID.
+void
+lapicipi(int apicid, int vector)
+{
+  while(lapic[ICRLO] & DELIVS)
+    ;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | vector);
+}
+
 #define CMOS_PORT    0x70
 #define CMOS_RETURN  0x71
 
@@ -6,6 +6,11 @@
 #include "fs.h"
 #include "buf.h"
 
+// The flusher commits the open transaction once it has been open
+// FLUSHTICKS, or once it holds LOGDIRTY blocks.
+#define FLUSHTICKS 100
+#define LOGDIRTY   (LOGSIZE/2)
+
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
@@ -17,9 +22,26 @@
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
-// commit中であればそれが終わるまでsleepする
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// has the flusher commit and sleeps until there is room.
+//
+// The cache is write-back: end_op() does not commit.  The open
+// transaction gathers operations (group commit) until the flusher,
+// a kernel thread, commits it: after FLUSHTICKS, when it holds
+// LOGDIRTY blocks, or when begin_op() needs room.  log_sync()
+// (the fsync system call) commits at once and waits for the disk.
+// To commit, force() keeps new operations out until the outstanding
+// ones end.
+//
+// The log is double-buffered in memory.  At commit the open
+// transaction's blocks are copied into the log blocks in the buffer
+// cache (a brief pause during which begin_op() waits), and a new
+// transaction opens at once.  New system calls then run while the
+// closed transaction is written to the log, committed and installed,
+// so writers do not wait for the disk.
+// Installs write the copied data to the home locations directly,
+// never through the cache, so they cannot disturb blocks the open
+// transaction is modifying.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,7 +50,8 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are synchronous, but each batch of log writes and
+// installs is queued as a whole and merged by the disk driver.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -46,14 +69,31 @@ struct log {
   int size;
   // 現在実行中のファイル関係のシステムコール
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int committing;  // in commit(); a new transaction is open meanwhile.
+  int copying;     // commit() is copying blocks, please wait.
+  int forcing;     // force() waits for outstanding ops to end.
+  uint seq;        // number of the open transaction
+  uint durable;    // transactions up to this one are on disk
   int dev;
-  struct logheader lh;
+  struct logheader lh;   // open transaction
+  struct logheader clh;  // transaction being committed
+  // Log blocks holding clh's data, locked until installed.
+  struct buf *lbuf[LOGSIZE];
+  // Not in the cache; used to write clh's data to home locations.
+  struct buf ibuf[LOGSIZE];
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void flusher(void);
+
+// Flusher state, protected by tickslock so that the flusher can
+// sleep with a timeout (tsleep).
+static struct {
+  int now;   // commit at once
+  int idle;  // waiting for a transaction to open
+} flush;
 
 void
 initlog(int dev)
@@ -62,45 +102,67 @@ initlog(int dev)
     panic("initlog: too big logheader");
 
   struct superblock sb;
+  int i;
+
   initlock(&log.lock, "log");
+  for (i = 0; i < LOGSIZE; i++) {
+    initsleeplock(&log.ibuf[i].lock, "log install");
+    if ((log.ibuf[i].data = (uchar*)kalloc()) == 0)
+      panic("initlog: out of memory");
+  }
   readsb(dev, &sb);
   log.start = sb.logstart;
   log.size = sb.nlog;
   log.dev = dev;
+  log.seq = 1;
   recover_from_log();
+  kthread("flusher", flusher);
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location.
+// The data is in log.lbuf[]; it goes straight to disk through
+// log.ibuf[], so cached copies of the home blocks are untouched.
+// All the writes are queued before the disk starts, so it can sort
+// them and merge runs of adjacent home blocks into single commands.
 static void
 install_trans(void)
 {
   int tail;
+  struct buf *b;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+  ideplug();
+  for (tail = 0; tail < log.clh.n; tail++) {
+    b = &log.ibuf[tail];
+    acquiresleep(&b->lock);
+    memmove(b->data, log.lbuf[tail]->data, bsize);
+    b->dev = log.dev;
+    b->blockno = log.clh.block[tail];
+    b->flags = B_VALID;
+    bawrite(b);  // write dst to disk
+  }
+  ideunplug();
+  for (tail = 0; tail < log.clh.n; tail++) {
+    b = &log.ibuf[tail];
+    bwait(b);
+    releasesleep(&b->lock);
   }
 }
 
-// Read the log header from disk into the in-memory log header
+// Read the log header from disk into the committing log header
 static void
 read_head(void)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.clh.n = lh->n;
+  for (i = 0; i < log.clh.n; i++) {
+    log.clh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write the committing log header to disk.
 // This is the true point at which the
 // current transaction commits.
 static void
@@ -109,9 +171,9 @@ write_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = log.clh.n;
+  for (i = 0; i < log.clh.n; i++) {
+    hb->block[i] = log.clh.block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -120,12 +182,31 @@ write_head(void)
 static void
 recover_from_log(void)
 {
+  int tail;
+
   read_head();
+  for (tail = 0; tail < log.clh.n; tail++)
+    log.lbuf[tail] = bread(log.dev, log.start+tail+1); // read log block
   install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
+  for (tail = 0; tail < log.clh.n; tail++)
+    brelse(log.lbuf[tail]);
+  log.clh.n = 0;
   write_head(); // clear the log
 }
 
+// Tell the flusher a transaction is open, or that it should
+// commit now.
+static void
+flushwake(int now)
+{
+  acquire(&tickslock);
+  if(now)
+    flush.now = 1;
+  if(now || flush.idle)
+    wakeup(&flush);
+  release(&tickslock);
+}
+
 // called at the start of each FS system call.
 // ファイルシステムに関するシステムコールではじめに呼ばれる
 // logの記録を開始する
@@ -135,12 +216,16 @@ begin_op(void)
   // logを使用するためのロック
   acquire(&log.lock);
   while(1){
-	// commitしている最中であるならば，それが終わるまでsleepする
-    if(log.committing){
+	// commitがブロックをコピーしている最中であるならば，それが終わるまでsleepする
+    if(log.copying){
       sleep(&log, &log.lock);
 	// 現在のlogの数+(いま実行されているFS_syscall+自分自身)*(10: 最悪の場合)が保持できるlogの数を超えていないか
+    } else if(log.forcing){
+      // force() is waiting for outstanding ops to end.
+      sleep(&log, &log.lock);
     } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
       // this op might exhaust log space; wait for commit.
+      flushwake(1);
       sleep(&log, &log.lock);
 	  // 使用可能
     } else {
@@ -153,67 +238,171 @@ begin_op(void)
   }
 }
 
+// Close the open transaction and hand it to commit().
+// Caller holds log.lock, and no operation is outstanding.
+static void
+close_trans(void)
+{
+  log.clh = log.lh;
+  log.lh.n = 0;
+  log.copying = 1;
+  log.forcing = 0;
+  log.seq++;
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// Leaves the transaction open for the flusher to commit.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+  // begin_op() may be waiting for log space, and force() for
+  // the outstanding operations to end.
+  wakeup(&log);
+  if(log.outstanding == 0 && log.lh.n > 0)
+    flushwake(log.lh.n >= LOGDIRTY);
+  release(&log.lock);
+}
+
+// Commit the open transaction, if it has anything, and return
+// once it and all transactions before it are on disk.
+// Caller holds log.lock.
+static void
+force(void)
+{
+  uint want;
+
+  want = log.lh.n > 0 ? log.seq : log.seq - 1;
+  while(log.durable < want){
+    if(log.seq == want && log.outstanding == 0 && !log.committing){
+      log.committing = 1;
+      close_trans();
+      // call commit w/o holding locks, since not allowed
+      // to sleep with locks.
+      release(&log.lock);
+      commit();
+      acquire(&log.lock);
+      log.durable = want;
+      log.committing = 0;
+      wakeup(&log);
+    } else {
+      // Keep new operations out of the open transaction, so that
+      // the outstanding ones end and it can close.
+      if(log.seq == want && !log.committing)
+        log.forcing = 1;
+      sleep(&log, &log.lock);
+    }
   }
+}
+
+// Make every finished FS system call durable.
+void
+log_sync(void)
+{
+  acquire(&log.lock);
+  force();
   release(&log.lock);
+}
 
-  // 他にFS system callを実行しているスレッドがなかった場合
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// The flusher kernel thread.
+static void
+flusher(void)
+{
+  uint t0;
+
+  acquire(&tickslock);
+  for(;;){
+    // A transaction is open when end_op() leaves it with blocks
+    // in it; log.lh.n is read without log.lock, but end_op()
+    // wakes us afterwards.
+    flush.idle = 1;
+    while(!flush.now && log.lh.n == 0)
+      sleep(&flush, &tickslock);
+    flush.idle = 0;
+    t0 = ticks;
+    while(!flush.now && ticks - t0 < FLUSHTICKS)
+      tsleep(&flush, FLUSHTICKS - (ticks - t0));
+    flush.now = 0;
+    release(&tickslock);
+
+    log_sync();
+
+    acquire(&tickslock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to the log blocks in the cache.
+// No operation is running, so this is a consistent snapshot.
 static void
-write_log(void)
+copy_log(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+  for (tail = 0; tail < log.clh.n; tail++) {
+    struct buf *to = bgetblank(log.dev, log.start+tail+1); // log block
+    struct buf *from = bread(log.dev, log.clh.block[tail]); // cache block
+    memmove(to->data, from->data, bsize);
     brelse(from);
-    brelse(to);
+    log.lbuf[tail] = to;
+  }
+}
+
+// Write the log blocks to disk.
+// Queue them all before the disk starts; the log blocks are
+// adjacent, so they go out as one multi-sector command.
+static void
+write_log(void)
+{
+  int tail;
+
+  ideplug();
+  for (tail = 0; tail < log.clh.n; tail++)
+    bawrite(log.lbuf[tail]);  // write the log
+  ideunplug();
+  for (tail = 0; tail < log.clh.n; tail++)
+    bwait(log.lbuf[tail]);
+}
+
+// The committed blocks are installed; unpin the cached copies
+// unless the open transaction has modified them again.
+static void
+unpin_trans(void)
+{
+  int tail, i;
+  struct buf *b;
+
+  for (tail = 0; tail < log.clh.n; tail++) {
+    brelse(log.lbuf[tail]);
+    b = bread(log.dev, log.clh.block[tail]);
+    acquire(&log.lock);
+    for (i = 0; i < log.lh.n; i++)
+      if (log.lh.block[i] == b->blockno)
+        break;
+    if (i == log.lh.n)
+      b->flags &= ~B_DIRTY;
+    release(&log.lock);
+    brelse(b);
   }
 }
 
 // logのコミット
+// log.clh holds the closed transaction and log.copying is set.
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
-  }
+  copy_log();      // Snapshot modified blocks into the log blocks
+  acquire(&log.lock);
+  log.copying = 0; // Let the next transaction start
+  wakeup(&log);
+  release(&log.lock);
+
+  write_log();     // Write log blocks to disk
+  write_head();    // Write header to disk -- the real commit
+  install_trans(); // Now install writes to home locations
+  unpin_trans();
+  log.clh.n = 0;
+  write_head();    // Erase the transaction from the log
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -250,4 +439,3 @@ log_write(struct buf *b)
   b->flags |= B_DIRTY; // prevent eviction
   release(&log.lock);
 }
-
@@ -29,6 +29,7 @@ main(void)
   mpinit();        // detect other processors
   // LAPICの初期化，TBC: LAPICに内臓されているtimerの割り込みを処理できるようにセットアップして，TSSを有効化する？
   lapicinit();     // interrupt controller
+  timerinit();     // clock
   seginit();       // segment descriptors
   picinit();       // disable pic
   // IOAPICのIRQに割り込みをセットする(CPUの割り当ては行わない)
@@ -40,14 +41,14 @@ main(void)
   pinit();         // process table
   // Interrupt Descriptor Table(IDT)にgatedescriptorをセットする
   tvinit();        // trap vectors
-  // バッファキャッシュの初期化
-  binit();         // buffer cache
   fileinit();      // file table
   // IDE接続のデバイス(Diskなど)のセットアップ(I/Oデバイスの割り込みを有効化)
   ideinit();       // disk 
   startothers();   // start other processors
   // 4MBからMMIO領域の手前(物理アドレスの限界)までをフリーリストにつなげる
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  // バッファキャッシュの初期化
+  binit();         // buffer cache, whose data pages need kinit2's memory
   // 最初のプロセスのセットアップ(切り替えはmpmain)
   userinit();      // first user process
   mpmain();        // finish this processor's setup
@@ -15,14 +15,14 @@
 
 extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
 
-static int disksize;
+static uint disksize;  // bytes
 static uchar *memdisk;
 
 void
 ideinit(void)
 {
   memdisk = _binary_fs_img_start;
-  disksize = (uint)_binary_fs_img_size/BSIZE;
+  disksize = (uint)_binary_fs_img_size;
 }
 
 // Interrupt handler.
@@ -32,6 +32,30 @@ ideintr(void)
   // no-op
 }
 
+// The memory disk is synchronous: requests are done on submit.
+void
+idesubmit(struct buf *b)
+{
+  iderw(b);
+  if(b->flags & B_ASYNC)
+    bdone(b);
+}
+
+void
+ideawait(struct buf *b)
+{
+}
+
+void
+ideplug(void)
+{
+}
+
+void
+ideunplug(void)
+{
+}
+
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
@@ -46,15 +70,15 @@ iderw(struct buf *b)
     panic("iderw: nothing to do");
   if(b->dev != 1)
     panic("iderw: request not for disk 1");
-  if(b->blockno >= disksize)
+  if(b->blockno >= disksize/bsize)
     panic("iderw: block out of range");
 
-  p = memdisk + b->blockno*BSIZE;
+  p = memdisk + b->blockno*bsize;
 
   if(b->flags & B_DIRTY){
     b->flags &= ~B_DIRTY;
-    memmove(p, b->data, BSIZE);
+    memmove(p, b->data, bsize);
   } else
-    memmove(b->data, p, BSIZE);
+    memmove(b->data, p, bsize);
   b->flags |= B_VALID;
 }
@@ -38,6 +38,15 @@
 #define CR0_PG          0x80000000      // Paging
 
 #define CR4_PSE         0x00000010      // Page size extension
+#define CR4_PGE         0x00000080      // Page global enable
+
+// CPUID leaf 1 %edx feature bits
+#define CPUID_SEP       0x00000800      // SYSENTER/SYSEXIT
+
+// Model-specific registers for SYSENTER
+#define MSR_SYSENTER_CS  0x174          // kernel %cs; %ss is %cs+8
+#define MSR_SYSENTER_ESP 0x175          // kernel %esp
+#define MSR_SYSENTER_EIP 0x176          // kernel entry point
 
 // various segment selectors.
 #define SEG_KCODE 1  // kernel code
@@ -45,9 +54,10 @@
 #define SEG_UCODE 3  // user code
 #define SEG_UDATA 4  // user data+stack
 #define SEG_TSS   5  // this process's task state
+#define SEG_KCPU  6  // kernel per-cpu data: this CPU's struct cpu
 
 // cpu->gdt[NSEGS] holds the above segments.
-#define NSEGS     6
+#define NSEGS     7
 
 #ifndef __ASSEMBLER__
 // Segment Descriptor
@@ -124,6 +134,7 @@ struct segdesc {
 #define NPDENTRIES      1024    // # directory entries per page directory 1024=2**10
 #define NPTENTRIES      1024    // # PTEs per page table 1024=2**10
 #define PGSIZE          4096    // bytes mapped by a page 4096=2**12
+#define BIGPGSIZE       (1<<PDXSHIFT) // bytes mapped by a PTE_PS page directory entry (4MB)
 
 #define PGSHIFT         12      // log2(PGSIZE)
 #define PTXSHIFT        12      // offset of PTX in a linear address
@@ -141,7 +152,15 @@ struct segdesc {
 #define PTE_A           0x020   // Accessed
 #define PTE_D           0x040   // Dirty
 #define PTE_PS          0x080   // Page Size
+#define PTE_G           0x100   // Global: kept in the TLB across %cr3 loads
 #define PTE_MBZ         0x180   // Bits must be zero
+// Bits 9-11 are ignored by the MMU and left for the OS.
+#define PTE_COW         0x200   // Copy-on-write: shared, copy on first write
+
+// Page fault error code flags (trapframe err).
+#define FEC_PR          0x1     // Page fault caused by protection violation
+#define FEC_WR          0x2     // Page fault caused by a write
+#define FEC_U           0x4     // Page fault occured while in user mode
 
 // Address in page table or page directory entry
 // PPNを取り出す
@@ -1,15 +1,20 @@
 #define NPROC        64  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
+#define NPRIO         3  // scheduling priorities, 0 is highest
+#define QUANTUM       1  // time slice in ticks at priority 0, x4 per level
+#define BOOSTTICKS  100  // SCHED_MLFQ processes go back to priority 0 this often
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-// ひとつのシステムコールが使用するのは多くても10block
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
+// ひとつのシステムコールが使用するのは多くても20block
+#define MAXOPBLOCKS  20  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define NBUF         (MAXOPBLOCKS*10) // size of disk block cache
+#ifndef FSSIZE
+#define FSSIZE       4000  // size of file system in blocks; make FSSIZE=n
+#endif
 
@@ -8,17 +8,22 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+// The buffer is a page of its own; a power of two, so that
+// nread and nwrite can wrap around.
+#define PIPESIZE PGSIZE
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data;     // PIPESIZE bytes
   // 読み込まれたbyte数
   uint nread;     // number of bytes read
   // 書き込まれたbyte数
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  // sleepしている読み手/書き手の数．いなければwakeupしない
+  int nrwait;     // readers sleeping on nread
+  int nwwait;     // writers sleeping on nwrite
 };
 
 int
@@ -32,10 +37,14 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
+  if((p->data = kalloc()) == 0)
+    goto bad;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
   p->nread = 0;
+  p->nrwait = 0;
+  p->nwwait = 0;
   initlock(&p->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -49,8 +58,11 @@ pipealloc(struct file **f0, struct file **f1)
 
 //PAGEBREAK: 20
  bad:
-  if(p)
+  if(p){
+    if(p->data)
+      kfree(p->data);
     kfree((char*)p);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -71,6 +83,7 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
+    kfree(p->data);
     kfree((char*)p);
   } else
     release(&p->lock);
@@ -79,14 +92,16 @@ pipeclose(struct pipe *p, int writable)
 //PAGEBREAK: 40
 //addr[0: n-1]をpに書き込む
 //pipewriteではp->nwriteの値しか変化しない
+// Data is copied with memmove, in the largest pieces that fit
+// in the free part of the ring without wrapping.
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, m;
 
   // pipeのロックを獲得する(pのデータを保護するため)
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
+  for(i = 0; i < n; i += m){
 	// pipeのbufがマックスだったら読み出されるまでsleepする
     while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
 	  // このパイプの読み込み口が閉じている
@@ -98,16 +113,26 @@ pipewrite(struct pipe *p, char *addr, int n)
 	  // nreadを読み出そうとして待っているプロセスを起こす
 	  // 起きてもこいつがp->lockを持っているからすぐにwakeupすることはできない
 	  // つまり，sleepする前に書き出されることはない
-      wakeup(&p->nread);
+      if(p->nrwait)
+        wakeup(&p->nread);
 	  // p->nwriteをchanにしてsleep
 	  // p->nwriteは動的に変化する値であるため，この待ちを行なっているパイプがたくさんあるという状態にはならない
 	  // 仮に定数であったとしたら，他のパイプを待っているプロセスも起こしてしまうことになる
+      p->nwwait++;
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+      p->nwwait--;
     }
-	// PIPESIZEを越えて書き込まないように%PIPESIZEでClampしてやる
-    p->data[p->nwrite++ % PIPESIZE] = addr[i]j;
+	// 空いている領域のうち，リングの終端で折り返さずに書ける分だけまとめてコピーする
+    m = n - i;
+    if(m > PIPESIZE - (p->nwrite - p->nread))
+      m = PIPESIZE - (p->nwrite - p->nread);
+    if(m > PIPESIZE - p->nwrite % PIPESIZE)
+      m = PIPESIZE - p->nwrite % PIPESIZE;
+    memmove(p->data + p->nwrite % PIPESIZE, addr + i, m);
+    p->nwrite += m;
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+  if(p->nrwait)
+    wakeup(&p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
   return n;
 }
@@ -117,7 +142,7 @@ pipewrite(struct pipe *p, char *addr, int n)
 int
 piperead(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, m;
 
   // readしている間はwriteできないように，ロックを獲得する
   acquire(&p->lock);
@@ -128,14 +153,65 @@ piperead(struct pipe *p, char *addr, int n)
       return -1;
     }
 	// 読みだせるものがない場合，p->nreadをchanにしてsleepする
+    p->nrwait++;
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
+    p->nrwait--;
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  // 多くても2回のmemmove(リングの終端で折り返す場合)
+  for(i = 0; i < n && p->nread != p->nwrite; i += m){  //DOC: piperead-copy
+    m = n - i;
+    if(m > p->nwrite - p->nread)
+      m = p->nwrite - p->nread;
+    if(m > PIPESIZE - p->nread % PIPESIZE)
+      m = PIPESIZE - p->nread % PIPESIZE;
+    memmove(addr + i, p->data + p->nread % PIPESIZE, m);
+    p->nread += m;
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  if(p->nwwait)
+    wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  release(&p->lock);
+  return i;
+}
+
+// Wait until p has room for at least one byte.
+// Return -1 if the read end is closed or the caller is killed.
+int
+pipewaitspace(struct pipe *p)
+{
+  acquire(&p->lock);
+  while(p->nwrite == p->nread + PIPESIZE){
+    if(p->readopen == 0 || myproc()->killed){
+      release(&p->lock);
+      return -1;
+    }
+    p->nwwait++;
+    sleep(&p->nwrite, &p->lock);
+    p->nwwait--;
+  }
+  release(&p->lock);
+  return 0;
+}
+
+// Copy as much of src[0: n-1] into pipe arg as fits now,
+// without sleeping; for readiput.  Return the bytes taken.
+int
+pipeput(void *arg, char *src, int n)
+{
+  struct pipe *p = arg;
+  int i, m;
+
+  acquire(&p->lock);
+  for(i = 0; i < n && p->nwrite != p->nread + PIPESIZE; i += m){
+    m = n - i;
+    if(m > PIPESIZE - (p->nwrite - p->nread))
+      m = PIPESIZE - (p->nwrite - p->nread);
+    if(m > PIPESIZE - p->nwrite % PIPESIZE)
+      m = PIPESIZE - p->nwrite % PIPESIZE;
+    memmove(p->data + p->nwrite % PIPESIZE, src + i, m);
+    p->nwrite += m;
+  }
+  if(p->nrwait)
+    wakeup(&p->nread);
   release(&p->lock);
   return i;
 }
@@ -0,0 +1,62 @@
+// Pipe throughput benchmark.
+//
+// For each write size, a child writes TOTAL bytes into a pipe in
+// writes of that size while the parent reads them in reads of the
+// same size, and the transfer rate is printed.  Time is measured
+// with clock().
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "date.h"
+
+#define TOTAL  (1024*1024)
+
+char buf[8192];
+int sizes[] = { 1, 16, 128, 512, 4096, 8192 };
+
+int
+main(int argc, char *argv[])
+{
+  int fds[2], i, n, total, size, got, kbs;
+  uint us;
+  struct clockval t0, t1;
+
+  printf(1, "pipebench starting\n");
+  for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+    size = sizes[i];
+    // a byte at a time is slow; move less
+    total = size < 128 ? TOTAL / 16 : TOTAL;
+    if(pipe(fds) < 0){
+      printf(1, "pipebench: pipe failed\n");
+      exit();
+    }
+    clock(&t0);
+    if(fork() == 0){
+      close(fds[0]);
+      for(n = 0; n < total; n += size)
+        write(fds[1], buf, size);
+      exit();
+    }
+    close(fds[1]);
+    got = 0;
+    while((n = read(fds[0], buf, size)) > 0)
+      got += n;
+    close(fds[0]);
+    wait();
+    clock(&t1);
+    if(got != total){
+      printf(1, "pipebench: got %d bytes, want %d\n", got, total);
+      exit();
+    }
+
+    // KB/s; count in 100us units so the product fits in an int
+    us = clockus(&t0, &t1);
+    if(us < 100)
+      us = 100;
+    kbs = (total / 1024) * 10000 / (us / 100);
+    printf(1, "pipebench: %d-byte writes: %d KB in %d us, %d.%d MB/s\n",
+           size, total / 1024, us, kbs / 1024, kbs % 1024 * 10 / 1024);
+  }
+  exit();
+}
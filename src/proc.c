@@ -6,12 +6,40 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "traps.h"
+#include "sched.h"
 
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
 } ptable;
 
+// Each CPU has its own queues of RUNNABLE processes, one per
+// priority (cpu->runq[]), so picking the next one is O(1) rather
+// than a scan of ptable.  The queues are protected by ptable.lock.
+// nqueued counts the processes in all queues; a CPU whose scheduler
+// finds it zero halts until an interrupt instead of spinning on
+// ptable.lock.
+static volatile uint nqueued;
+
+// Processes of class SCHED_MLFQ start at priority 0 and move down
+// a level each time they use up a whole time slice, which is
+// QUANTUM ticks at priority 0 and four times longer at each lower
+// level.  So CPU-bound processes sink, while interactive ones that
+// sleep before their slice ends stay on top.  Every BOOSTTICKS all
+// of them go back to priority 0, so none starves.  SCHED_FIXED
+// processes keep the priority set by setsched(), which may not be 0:
+// the top level belongs to SCHED_MLFQ, so that after a boost every
+// adaptive process runs, whatever fixed ones are spinning.
+static uint lastboost;
+
+// Sleeping processes wait in a queue picked by hashing their chan,
+// so wakeup(chan) only looks at the few processes sleeping on chan
+// or on channels that hash alike, not at all of ptable.  The queues
+// are protected by ptable.lock.
+#define NSLEEPQ 64
+static struct proc *sleepq[NSLEEPQ];
+
 static struct proc *initproc;
 
 int nextpid = 1;
@@ -19,6 +47,7 @@ extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
+static void setrunnable(struct proc *p);
 
 void
 pinit(void)
@@ -32,25 +61,18 @@ cpuid() {
   return mycpu()-cpus;
 }
 
-// Must be called with interrupts disabled to avoid the caller being
-// rescheduled between reading lapicid and running through the loop.
-// 割り込みを無効化した状態で呼ばれる必要がある
-// この関数の実行の中で割り込みが許可されている場合，lapicidの読み出し後にスケジューリングされて現在実行されているCPUではないCPUの構造体を返してしまうかもしれない
+// Find the running CPU's struct by its local APIC ID, the slow
+// way, for seginit(), which then sets up %gs for mycpu().
+// Must be called with interrupts disabled.
+// APIC(Advanced Programmable Interrupt Controller, エイピック): インテルにより開発された、x86アーキテクチャにおける割り込みコントローラ
 struct cpu*
-mycpu(void)
+cpulookup(void)
 {
-  // APIC(Advanced Programmable Interrupt Controller, エイピック): インテルにより開発された、x86アーキテクチャにおける割り込みコントローラ
-  // LAPICのuniqueid
   int apicid, i;
 
-  // FLAGS register contains the current state of the processor
-  if(readeflags()&FL_IF)
-    panic("mycpu called with interrupts enabled\n");
-
   // LAPICからIDを読み出す
   apicid = lapicid();
-  // APIC IDs are not guaranteed to be contiguous. Maybe we should have
-  // a reverse map, or reserve a register to store &cpus[i].
+  // APIC IDs are not guaranteed to be contiguous.
   // lapicidが一致するcpuの構造体を取り出す
   for (i = 0; i < ncpu; ++i) {
     if (cpus[i].apicid == apicid)
@@ -59,16 +81,31 @@ mycpu(void)
   panic("unknown apicid\n");
 }
 
-// Disable interrupts so that we are not rescheduled
-// while reading proc from the cpu structure
+// Must be called with interrupts disabled to avoid the caller being
+// rescheduled to another CPU while it uses the result.
+// 割り込みを無効化した状態で呼ばれる必要がある
+// 割り込みが許可されている場合，読み出し後に別のCPUにスケジューリングされて現在実行されていないCPUの構造体を使ってしまうかもしれない
+struct cpu*
+mycpu(void)
+{
+  struct cpu *c;
+
+  // FLAGS register contains the current state of the processor
+  if(readeflags()&FL_IF)
+    panic("mycpu called with interrupts enabled\n");
+  asm volatile("movl %%gs:0, %0" : "=r" (c));
+  return c;
+}
+
+// A single load through %gs, which cannot be split by an
+// interrupt; and a process's proc is the same on any CPU, so no
+// pushcli is needed even if we are rescheduled right after.
 struct proc*
 myproc(void) {
-  struct cpu *c;
   struct proc *p;
-  pushcli();
-  c = mycpu();
-  p = c->proc;
-  popcli();
+
+  asm volatile("movl %%gs:%c1, %0" : "=r" (p)
+               : "i" (__builtin_offsetof(struct cpu, proc)));
   return p;
 }
 
@@ -97,6 +134,10 @@ found:
   p->state = EMBRYO;
   // ユニークなプロセスIDを割り当てる
   p->pid = nextpid++;
+  p->sclass = SCHED_MLFQ;
+  p->prio = 0;
+  p->slice = 0;
+  p->rticks = p->wticks = p->maxwait = p->nsched = 0;
 
   release(&ptable.lock);
 
@@ -171,27 +212,72 @@ userinit(void)
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&ptable.lock);
 }
 
+// Kernel threads start here instead of at forkret.  The return
+// goes to the thread's function, which kthread put where forkret
+// would find trapret.
+static void
+kthreadret(void)
+{
+  // Still holding ptable.lock from scheduler.
+  release(&ptable.lock);
+}
+
+// Start a kernel thread running fn, which must never return.
+// It has no user memory and no parent, and ignores kill.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread: no proc");
+  if((p->pgdir = setupkvm()) == 0)
+    panic("kthread: out of memory");
+  p->sz = 0;
+  *(uint*)(p->context + 1) = (uint)fn;
+  p->context->eip = (uint)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  setrunnable(p);
+  release(&ptable.lock);
+}
+
 // Grow current process's memory by n bytes.
+// Growing only reserves the address space; pages are allocated
+// and zeroed by pagefault() when they are first touched.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
 {
   uint sz;
+  struct progseg *s;
   // 現在実行中のプロセスの情報を取得
   struct proc *curproc = myproc();
 
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if(sz + n < sz || sz + n >= KERNBASE)
       return -1;
+    sz += n;
   } else if(n < 0){
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
+    // Memory given back and grown again must read as zeros,
+    // not be paged in from the program file again.
+    for(s = curproc->seg; s < &curproc->seg[curproc->nseg]; s++){
+      if(s->vaddr >= PGROUNDUP(sz))
+        s->memsz = s->filesz = 0;
+      else if(s->vaddr + s->memsz > PGROUNDUP(sz))
+        s->memsz = PGROUNDUP(sz) - s->vaddr;
+      if(s->filesz > s->memsz)
+        s->filesz = s->memsz;
+    }
   }
   curproc->sz = sz;
   // cr3にpgdirを再セットし、TLBを更新
@@ -232,6 +318,14 @@ fork(void)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  // The child faults in the pages the parent never touched.
+  if(curproc->exe){
+    np->exe = idup(curproc->exe);
+    iexec(np->exe);
+  }
+  memmove(np->seg, curproc->seg, sizeof(curproc->seg));
+  np->nseg = curproc->nseg;
+  np->npagein = 0;
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
@@ -239,7 +333,12 @@ fork(void)
 
   acquire(&ptable.lock);
 
-  np->state = RUNNABLE;
+  np->cpu = curproc->cpu;
+  // A fixed priority is inherited; an adaptive one starts on top.
+  np->sclass = curproc->sclass;
+  if(np->sclass == SCHED_FIXED)
+    np->prio = curproc->prio;
+  setrunnable(np);
 
   release(&ptable.lock);
 
@@ -270,8 +369,12 @@ exit(void)
 
   begin_op();
   iput(curproc->cwd);
+  if(curproc->exe)
+    iputexec(curproc->exe);
   end_op();
   curproc->cwd = 0;
+  curproc->exe = 0;
+  curproc->nseg = 0;
 
   // プロセステーブルのロック獲得
   acquire(&ptable.lock);
@@ -349,6 +452,266 @@ wait(void)
   }
 }
 
+//PAGEBREAK: 30
+// Time slice at priority prio, in ticks.
+static uint
+quantum(int prio)
+{
+  return QUANTUM << (2*prio);
+}
+
+// Append p to c's run queue for its priority.
+// Caller must hold ptable.lock.
+static void
+runqput(struct cpu *c, struct proc *p)
+{
+  p->rqnext = 0;
+  if(c->runqtail[p->prio])
+    c->runqtail[p->prio]->rqnext = p;
+  else
+    c->runq[p->prio] = p;
+  c->runqtail[p->prio] = p;
+  c->nrun++;
+  p->qtime = ticks;
+  __sync_fetch_and_add(&nqueued, 1);
+}
+
+// Remove and return the first process of the highest priority
+// in c's run queues, or 0 if they are empty.
+// Caller must hold ptable.lock.
+static struct proc*
+runqget(struct cpu *c)
+{
+  struct proc *p;
+  int i;
+
+  for(i = 0; i < NPRIO; i++)
+    if(c->runq[i])
+      break;
+  if(i == NPRIO)
+    return 0;
+  p = c->runq[i];
+  c->runq[i] = p->rqnext;
+  if(c->runq[i] == 0)
+    c->runqtail[i] = 0;
+  p->rqnext = 0;
+  c->nrun--;
+  __sync_fetch_and_sub(&nqueued, 1);
+  return p;
+}
+
+// Remove RUNNABLE p from whichever run queue it is in.
+// Caller must hold ptable.lock.
+static struct cpu*
+runqremove(struct proc *p)
+{
+  struct cpu *c;
+  struct proc **pp, *prev;
+
+  for(c = cpus; c < &cpus[ncpu]; c++){
+    prev = 0;
+    for(pp = &c->runq[p->prio]; *pp; pp = &(*pp)->rqnext){
+      if(*pp == p){
+        *pp = p->rqnext;
+        if(c->runqtail[p->prio] == p)
+          c->runqtail[p->prio] = prev;
+        p->rqnext = 0;
+        c->nrun--;
+        __sync_fetch_and_sub(&nqueued, 1);
+        return c;
+      }
+      prev = *pp;
+    }
+  }
+  panic("runqremove");
+}
+
+// Choose the next process for c to run.  If another CPU's queue
+// is longer than c's by more than one, take from it first, so the
+// queues stay balanced; an idle CPU takes from any queue.
+// Caller must hold ptable.lock.
+static struct proc*
+runqpick(struct cpu *c)
+{
+  struct cpu *o, *busiest;
+
+  busiest = 0;
+  for(o = cpus; o < &cpus[ncpu]; o++)
+    if(o != c && (busiest == 0 || o->nrun > busiest->nrun))
+      busiest = o;
+  if(busiest && busiest->nrun > c->nrun + 1)
+    return runqget(busiest);
+  if(c->nrun == 0 && busiest)
+    return runqget(busiest);
+  return runqget(c);
+}
+
+// Put every SCHED_MLFQ process back at priority 0.
+// Caller must hold ptable.lock.
+static void
+boost(void)
+{
+  struct proc *p;
+  struct cpu *c;
+  uint qtime;
+
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->state == UNUSED || p->sclass != SCHED_MLFQ || p->prio == 0)
+      continue;
+    if(p->state == RUNNABLE){
+      c = runqremove(p);
+      qtime = p->qtime;
+      p->prio = 0;
+      runqput(c, p);
+      p->qtime = qtime;
+    } else
+      p->prio = 0;
+    p->slice = 0;
+  }
+}
+
+// Charge the current process for a clock tick.  Return 1 if it
+// should give up the CPU: its time slice is used up, or a process
+// of higher priority is queued on this CPU.
+int
+schedtick(void)
+{
+  struct proc *p = myproc();
+  struct cpu *c;
+  int i, preempt;
+
+  preempt = 0;
+  acquire(&ptable.lock);
+  c = mycpu();
+  p->rticks++;
+  if(++p->slice >= quantum(p->prio)){
+    p->slice = 0;
+    if(p->sclass == SCHED_MLFQ && p->prio < NPRIO-1)
+      p->prio++;
+    preempt = 1;
+  }
+  for(i = 0; i < p->prio; i++)
+    if(c->runq[i])
+      preempt = 1;
+  if(ticks - lastboost >= BOOSTTICKS){
+    lastboost = ticks;
+    boost();
+  }
+  // No one to give the CPU to.
+  if(nqueued == 0)
+    preempt = 0;
+  release(&ptable.lock);
+  return preempt;
+}
+
+// Is p the caller or one of its descendants?
+// Caller must hold ptable.lock.
+static int
+ismine(struct proc *p)
+{
+  struct proc *curproc = myproc();
+
+  for(; p; p = p->parent)
+    if(p == curproc)
+      return 1;
+  return 0;
+}
+
+// Set the scheduling class and priority of process pid,
+// or of the caller if pid is 0.  A process may only change
+// itself and its descendants.
+int
+setsched(int pid, int class, int prio)
+{
+  struct proc *p;
+  struct cpu *c;
+
+  if(class != SCHED_MLFQ && class != SCHED_FIXED)
+    return -1;
+  if(prio < 0 || prio >= NPRIO)
+    return -1;
+  if(class == SCHED_FIXED && prio == 0)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid != pid || p->state == UNUSED)
+      continue;
+    if(!ismine(p))
+      break;
+    if(p->state == RUNNABLE){
+      c = runqremove(p);
+      p->prio = prio;
+      runqput(c, p);
+    } else
+      p->prio = prio;
+    p->sclass = class;
+    p->slice = 0;
+    release(&ptable.lock);
+    return 0;
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// Copy the scheduling state of process pid, or of the caller
+// if pid is 0, to *si.
+int
+getsched(int pid, struct schedinfo *si)
+{
+  struct proc *p;
+  struct schedinfo s;
+
+  if(pid == 0)
+    pid = myproc()->pid;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid != pid || p->state == UNUSED)
+      continue;
+    s.class = p->sclass;
+    s.prio = p->prio;
+    s.rticks = p->rticks;
+    s.wticks = p->wticks;
+    s.maxwait = p->maxwait;
+    s.nsched = p->nsched;
+    release(&ptable.lock);
+    // si is user memory and may fault; not under ptable.lock.
+    *si = s;
+    return 0;
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// Mark p RUNNABLE and queue it on the CPU it last ran on, which
+// likely still caches its memory.  If that CPU is busy and another
+// is halted with nothing to do, queue it there and wake that CPU.
+// Caller must hold ptable.lock.
+static void
+setrunnable(struct proc *p)
+{
+  struct cpu *c, *o;
+
+  p->state = RUNNABLE;
+  c = &cpus[p->cpu];
+  if(c->nrun > 0 || (c->proc != 0 && c->proc != p)){
+    for(o = cpus; o < &cpus[ncpu]; o++){
+      if(o->idle){
+        c = o;
+        break;
+      }
+    }
+  }
+  runqput(c, p);
+  // runqput's atomic add orders the queue update before
+  // this read of c->idle; see the halt in scheduler().
+  if(c->idle && c != mycpu())
+    lapicipi(c->apicid, T_IRQ0 + IRQ_RESCHED);
+}
+
 //PAGEBREAK: 42
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
@@ -374,19 +737,52 @@ scheduler(void)
 	// I/O待ちでSLEEPINGしていたプロセスがいつまでたってもRUNNABLEにならない(Diskを例としてあげるなら，ideintrがいつまでも呼ばれないということ)
     sti();
 
-    // Loop over process table looking for process to run.
+    // Nothing to run anywhere: halt until an interrupt, which
+    // is the timer, a device, or setrunnable() on another CPU.
+    // While halted the CPU takes no clock ticks; its timer is set
+    // to fire only when the next sleeper is due.
+    // Setting idle before the final check of nqueued, each with
+    // a locked instruction, means setrunnable() either sees idle
+    // and sends the IPI, or queued its process before the check.
+    if(nqueued == 0){
+      cli();
+      xchg(&c->idle, 1);
+      if(nqueued == 0){
+        timeridle();
+        stihlt();
+        lapicperiodic();
+      }
+      c->idle = 0;
+      continue;
+    }
+
     acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if((p = runqpick(c)) != 0){
       if(p->state != RUNNABLE)
-        continue;
+        panic("scheduler");
 
       // Switch to chosen process.  It is the process's job
       // to release ptable.lock and then reacquire it
       // before jumping back to us.
       c->proc = p;
+      p->nsched++;
+      p->wticks += ticks - p->qtime;
+      if(ticks - p->qtime > p->maxwait)
+        p->maxwait = ticks - p->qtime;
 	  // pgdirの切り替え
-      switchuvm(p);
+      // If p was the last process to run here and has not run on
+      // another CPU since, this CPU's TSS and %cr3 are still p's,
+      // and its TLB entries for p's memory are still right: p's
+      // page tables change only while p runs, and p then flushes
+      // the TLB itself.  (Had p exited or exec'd, its old page
+      // directory could not be p->pgdir; see freevm.)
+      if(p->cpu != c - cpus || c->pgdir != p->pgdir)
+        switchuvm(p);
+      else
+        c->nlazy++;
       p->state = RUNNING;
+      p->cpu = c - cpus;
+      c->nswitch++;
 
 	  // cpuが保持しているschedulerと, process構造体にセットされているコンテキスト
 	  /*
@@ -401,13 +797,13 @@ scheduler(void)
       swtch(&(c->scheduler), p->context);
 	  // Schedでここから再開
 	  // この段階で実行されているのかschedulerのみであり，ユーザは存在しない．
-      switchkvm();
+      // Stay on p's page table: the kernel's part of it is the same
+      // in every page table, and the next process may well be p.
 
       // Process is done running for now.
       // It should have changed its p->state before coming back.
       c->proc = 0;
     }
-	// RUNNABLEが存在しない場合，&ptable.lockを解放してあげないと，ptableを誰もいじれないため，何かしらのプロセスをRUNNABLEにセットすることもできない
     release(&ptable.lock);
 
   }
@@ -447,7 +843,7 @@ void
 yield(void)
 {
   acquire(&ptable.lock);  //DOC: yieldlock
-  myproc()->state = RUNNABLE;
+  setrunnable(myproc());
   sched();
   release(&ptable.lock);
 }
@@ -477,6 +873,30 @@ forkret(void)
   // Return to "caller", actually trapret (see allocproc).
 }
 
+// The sleep queue for chan.
+static struct proc**
+sleepqhead(void *chan)
+{
+  return &sleepq[((uint)chan * 2654435761U) >> 26];  // top 6 bits
+}
+
+// Take SLEEPING p off its sleep queue.
+// Caller must hold ptable.lock.
+static void
+sleepqremove(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = sleepqhead(p->chan); *pp; pp = &(*pp)->sqnext){
+    if(*pp == p){
+      *pp = p->sqnext;
+      p->sqnext = 0;
+      return;
+    }
+  }
+  panic("sleepqremove");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 // スリープするときにロックを解放し、再開するときに再び獲得する
@@ -499,20 +919,26 @@ sleep(void *chan, struct spinlock *lk)
   // guaranteed that we won't miss any wakeup
   // (wakeup runs with ptable.lock locked),
   // so it's okay to release lk.
+  // p joins chan's sleep queue before lk is released, so a
+  // wakeup() made under lk that finds the queue empty has
+  // nobody to wake.
   // waitの中でptable.lockを引数にsleepが呼び出される．
-  if(lk != &ptable.lock){  //DOC: sleeplock0
+  if(lk != &ptable.lock)  //DOC: sleeplock0
     acquire(&ptable.lock);  //DOC: sleeplock1
-	// spinlockを一旦解放し、割り込みを有効化する
-    release(lk);
-  }
+
   // Go to sleep.
   // pは現在実行中のプロセス
-  // スリープして待つsleeplock
-  // => TBC: wakeの際にp.tableからSLEEPINGなものを探して、chanを見て起こす
+  // chanのスリープキューにつなぐ(wakeupはこのキューだけを見る)
   p->chan = chan;
+  p->sqnext = *sleepqhead(chan);
+  *sleepqhead(chan) = p;
   // スリープに入る
   p->state = SLEEPING;
 
+  if(lk != &ptable.lock)
+	// spinlockを一旦解放し、割り込みを有効化する
+    release(lk);
+
   // p.tableのロックを獲得している必要がある
   sched();
   // wakeで起こされたらここから再開する
@@ -536,18 +962,31 @@ sleep(void *chan, struct spinlock *lk)
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
-
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  struct proc **pp, *p;
+
+  pp = sleepqhead(chan);
+  while((p = *pp) != 0){
+    if(p->chan == chan){
+      *pp = p->sqnext;
+      p->sqnext = 0;
+      setrunnable(p);
+    } else
+      pp = &p->sqnext;
+  }
 }
 
 // Wake up all processes sleeping on chan.
 // chanを待ってSLEEPINGしてるプロセスをRUNNABLEにセットする
+// The caller holds the lock that sleepers on chan pass to
+// sleep(), so if chan's sleep queue is empty nobody can be
+// sleeping on it, and ptable.lock need not be taken at all.
+// That is the common case for the clock tick, disk completions
+// and pipes.
 void
 wakeup(void *chan)
 {
+  if(*sleepqhead(chan) == 0)
+    return;
   acquire(&ptable.lock);
   wakeup1(chan);
   release(&ptable.lock);
@@ -566,8 +1005,10 @@ kill(int pid)
     if(p->pid == pid){
       p->killed = 1;
       // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
+      if(p->state == SLEEPING){
+        sleepqremove(p);
+        setrunnable(p);
+      }
       release(&ptable.lock);
       return 0;
     }
@@ -603,7 +1044,8 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    cprintf("%d %s %s", p->pid, state, p->name);
+    cprintf("%d %s %s pagein %d prio %d", p->pid, state, p->name,
+            p->npagein, p->prio);
     if(p->state == SLEEPING){
       getcallerpcs((uint*)p->context->ebp+2, pc);
       for(i=0; i<10 && pc[i] != 0; i++)
@@ -611,4 +1053,7 @@ procdump(void)
     }
     cprintf("\n");
   }
+  for(i = 0; i < ncpu; i++)
+    cprintf("cpu%d: runq %d switches %d lazy %d%s\n", i, cpus[i].nrun,
+            cpus[i].nswitch, cpus[i].nlazy, cpus[i].idle ? " idle" : "");
 }
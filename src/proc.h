@@ -1,5 +1,7 @@
 // Per-CPU state
 struct cpu {
+  // %gsはSEG_KCPU(このcpu構造体)を指すので，%gs:0でmycpu()が得られる
+  struct cpu *self;            // This struct; %gs:0, see mycpu()
   // LAPICから読み出す
   uchar apicid;                // Local APIC ID
   // cpu->schedulerはcontextの位置を指している
@@ -12,6 +14,15 @@ struct cpu {
   // ncli=0でpushcliが呼び出されたときのeflagsの値を保持しておく
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  // このCPUで実行待ちのプロセス(優先度ごとのFIFO)．ptable.lockで保護される
+  struct proc *runq[NPRIO];    // Run queue heads by priority
+  struct proc *runqtail[NPRIO];// Run queue tails
+  int nrun;                    // Processes in all run queues
+  volatile uint idle;          // Halted in scheduler, waiting for work
+  uint nswitch;                // Switches to a process
+  // switchuvmで最後にcr3にセットしたpgdir(参照を1つ保持する)
+  pde_t *pgdir;                // Page directory in %cr3, or 0 for kpgdir
+  uint nlazy;                  // Switches that kept the loaded pgdir
 };
 
 extern struct cpu cpus[NCPU];
@@ -40,6 +51,16 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A loadable ELF segment that exec() left on disk.  Its pages are
+// read from the program's inode when first touched (see pagefault).
+#define NPSEG 4
+struct progseg {
+  uint vaddr;                  // Page-aligned start of segment
+  uint memsz;                  // Size in memory
+  uint off;                    // Offset of segment in the file
+  uint filesz;                 // Bytes in file; rest is zero-filled
+};
+
 // Per-process state
 struct proc {
   uint sz;                     // Size of process memory (bytes)
@@ -55,6 +76,21 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  struct inode *exe;           // Program file, for demand paging
+  struct progseg seg[NPSEG];   // Segments of exe not yet loaded
+  int nseg;
+  uint npagein;                // Pages read from exe by page faults
+  struct proc *rqnext;         // Next in run queue, if RUNNABLE
+  struct proc *sqnext;         // Next in sleep queue, if SLEEPING
+  int cpu;                     // Index in cpus[] of CPU last run on
+  int sclass;                  // Scheduling class, SCHED_MLFQ or SCHED_FIXED
+  int prio;                    // Priority, 0 (highest) to NPRIO-1
+  uint slice;                  // Ticks used of the current time slice
+  uint qtime;                  // ticks when last queued
+  uint rticks;                 // Ticks spent running
+  uint wticks;                 // Ticks spent waiting in a run queue
+  uint maxwait;                // Longest wait in a run queue
+  uint nsched;                 // Times scheduled
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -0,0 +1,14 @@
+// Scheduling classes, for setsched().
+#define SCHED_MLFQ   0   // priority drops as time slices are used up
+#define SCHED_FIXED  1   // priority stays where setsched() put it, 1 or lower
+
+// Scheduling state and CPU accounting of a process, from getsched().
+// Priority 0 is the highest, NPRIO-1 the lowest.
+struct schedinfo {
+  int class;
+  int prio;
+  uint rticks;    // clock ticks spent running
+  uint wticks;    // ticks spent runnable, waiting for a CPU
+  uint maxwait;   // longest single wait for a CPU, in ticks
+  uint nsched;    // number of times scheduled
+};
@@ -0,0 +1,78 @@
+// Scheduling latency under load.
+//
+// Starts NHOG CPU-bound children at the lowest fixed priority,
+// then repeatedly sleeps for one tick, as an interactive program
+// waiting for input would, and measures how late it wakes up.
+// By default the measuring process also gets the highest fixed
+// priority, 1; "schedtest mlfq" leaves it in the default adaptive
+// class.
+// Each process prints its CPU accounting at the end.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "sched.h"
+
+#define NHOG    4
+#define NROUND  100
+
+void
+report(char *who)
+{
+  struct schedinfo si;
+
+  if(getsched(0, &si) < 0){
+    printf(1, "schedtest: getsched failed\n");
+    return;
+  }
+  printf(1, "%s %d: class %d prio %d run %d wait %d maxwait %d sched %d\n",
+         who, getpid(), si.class, si.prio, si.rticks, si.wticks,
+         si.maxwait, si.nsched);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, pid, late, worst;
+  uint t0, t1, end;
+  volatile int x;
+
+  printf(1, "schedtest starting\n");
+  if(argc < 2 || strcmp(argv[1], "mlfq") != 0)
+    setsched(0, SCHED_FIXED, 1);
+
+  end = uptime() + NROUND + 50;
+  for(i = 0; i < NHOG; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "schedtest: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      setsched(0, SCHED_FIXED, NPRIO-1);
+      for(x = 0; uptime() < end; x++)
+        ;
+      report("hog");
+      exit();
+    }
+  }
+
+  late = worst = 0;
+  for(i = 0; i < NROUND; i++){
+    t0 = uptime();
+    sleep(1);
+    t1 = uptime();
+    if(t1 - t0 > 2)
+      late++;
+    if(t1 - t0 > worst)
+      worst = t1 - t0;
+  }
+  printf(1, "schedtest: %d sleeps, %d late, worst %d ticks\n",
+         NROUND, late, worst);
+  report("interactive");
+
+  for(i = 0; i < NHOG; i++)
+    wait();
+  exit();
+}
@@ -0,0 +1,64 @@
+// Cost of many sleeping processes.
+//
+// Counts how far a CPU-bound loop gets in NTICK ticks, first
+// alone and then while NSLEEPER processes sleep(SLEEPTICKS)
+// over and over.  Whatever the kernel spends on the sleepers'
+// behalf (waking them, timer interrupts) comes out of the loop.
+// Run it with CPUS=1 so the loop and the sleepers share a CPU.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NSLEEPER    48
+#define SLEEPTICKS  20
+#define NTICK       200
+
+// Spin for NTICK ticks; return the loop count in thousands.
+uint
+spin(void)
+{
+  uint end, n;
+  volatile int i;
+
+  end = uptime() + NTICK;
+  for(n = 0; uptime() < end; n++)
+    for(i = 0; i < 1000; i++)
+      ;
+  return n;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, pid[NSLEEPER];
+  uint base, loaded;
+
+  printf(1, "sleepbench starting\n");
+  base = spin();
+
+  for(n = 0; n < NSLEEPER; n++){
+    pid[n] = fork();
+    if(pid[n] < 0){
+      printf(1, "sleepbench: fork failed\n");
+      break;
+    }
+    if(pid[n] == 0){
+      for(;;)
+        sleep(SLEEPTICKS);
+    }
+  }
+  loaded = spin();
+
+  printf(1, "sleepbench: %d sleepers: %dk loops in %d ticks, %dk alone",
+         n, loaded, NTICK, base);
+  if(base > 0)
+    printf(1, " (%d%% overhead)", loaded < base ? (base - loaded) * 100 / base : 0);
+  printf(1, "\n");
+
+  for(i = 0; i < n; i++)
+    kill(pid[i]);
+  for(i = 0; i < n; i++)
+    wait();
+  exit();
+}
@@ -9,12 +9,39 @@
 #include "proc.h"
 #include "spinlock.h"
 
+// Waiters poll the lock every BACKOFF_MIN pause instructions at
+// first, backing off exponentially to every BACKOFF_MAX, to keep
+// the lock's cache line quieter for the holder.  The cap is low:
+// with tickets, a waiter that sleeps past its turn stalls everyone
+// queued behind it.
+#define BACKOFF_MIN 1
+#define BACKOFF_MAX 64
+
+extern char end[]; // first address after kernel loaded from ELF file
+
+// All locks in the kernel's static data, for lockdump().  Locks
+// in allocated memory, such as pipes', are left off the list,
+// since they may be freed.  Entries are never removed.
+static struct spinlock *locklist;
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
   lk->cpu = 0;
+  lk->nacquire = 0;
+  lk->ncontend = 0;
+  lk->spin = 0;
+  // Static memory starts zeroed, so listed tells whether an
+  // earlier initlock already put lk on the list.
+  if((char*)lk < end && !lk->listed){
+    lk->listed = 1;
+    do
+      lk->nextlock = locklist;
+    while(!__sync_bool_compare_and_swap(&locklist, lk->nextlock, lk));
+  }
 }
 
 // Acquire the lock.
@@ -26,16 +53,28 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint ticket, delay, i;
+  uint64 t0;
+
   pushcli(); // disable interrupts to avoid deadlock.
   // 自分自身がロックを獲得していたらおかしい
   if(holding(lk))
     panic("acquire");
 
-  // The xchg is atomic.
-  // lockがすでに獲得されている場合のxchgの返り値は1
-  // つまり、lockが獲得できる状態になるまでビジーループ
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  // The fetch-and-add is atomic.
+  // 整理券を取り、ownerが自分の番号になるまでビジーループ
+  ticket = __sync_fetch_and_add(&lk->next, 1);
+  t0 = 0;
+  if(*(volatile uint*)&lk->owner != ticket){
+    t0 = rdtsc();
+    delay = BACKOFF_MIN;
+    while(*(volatile uint*)&lk->owner != ticket){
+      for(i = 0; i < delay; i++)
+        pause();
+      if(delay < BACKOFF_MAX)
+        delay *= 2;
+    }
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -47,6 +86,11 @@ acquire(struct spinlock *lk)
   // Record info about lock acquisition for debugging.
   lk->cpu = mycpu();
   getcallerpcs(&lk, lk->pcs);
+  lk->nacquire++;
+  if(t0){
+    lk->ncontend++;
+    lk->spin += rdtsc() - t0;
+  }
 }
 
 // Release the lock.
@@ -69,10 +113,11 @@ release(struct spinlock *lk)
   // stores; __sync_synchronize() tells them both not to.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code can't use a C assignment, since it might
-  // not be atomic. A real OS would use C atomics here.
-  asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+  // Release the lock, equivalent to lk->owner++: hand it to
+  // the next ticket.  Only the holder writes owner, so a plain
+  // increment will do, but it must be a single store that the
+  // compiler cannot split or move.
+  asm volatile("incl %0" : "+m" (lk->owner) : );
 
   popcli();
 }
@@ -100,7 +145,40 @@ getcallerpcs(void *v, uint pcs[])
 int
 holding(struct spinlock *lock)
 {
-  return lock->locked && lock->cpu == mycpu();
+  return lock->owner != lock->next && lock->cpu == mycpu();
+}
+
+// Print statistics of the static locks, summed by lock name.
+// Runs when user types ^L on console.
+// No lock, like procdump.
+void
+lockdump(void)
+{
+  struct spinlock *lk, *l;
+  uint n, nacquire, ncontend;
+  uint64 spin;
+
+  for(lk = locklist; lk; lk = lk->nextlock){
+    // Report each name once, at its first lock on the list.
+    for(l = locklist; l != lk && l->name != lk->name; l = l->nextlock)
+      ;
+    if(l != lk)
+      continue;
+    n = nacquire = ncontend = 0;
+    spin = 0;
+    for(l = lk; l; l = l->nextlock){
+      if(l->name != lk->name)
+        continue;
+      n++;
+      nacquire += l->nacquire;
+      ncontend += l->ncontend;
+      spin += l->spin;
+    }
+    if(nacquire == 0)
+      continue;
+    cprintf("%s (%d): acquire %d contended %d spin %d Kcycles\n",
+            lk->name, n, nacquire, ncontend, (uint)(spin >> 10));
+  }
 }
 
 
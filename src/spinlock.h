@@ -1,12 +1,21 @@
 // Mutual exclusion lock.
-// lock=0 -> どのプロセスも利用していないため，ロックを獲得できる
+// A ticket lock: acquire takes the next ticket and waits until
+// owner reaches it, so CPUs get the lock in the order they asked.
+// next == owner -> どのプロセスも利用していないため，ロックを獲得できる
 struct spinlock {
-  uint locked;       // Is the lock held?
+  uint next;         // Next ticket to hand out
+  uint owner;        // Ticket that holds the lock; held if != next
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
   uint pcs[10];      // The call stack (an array of program counters)
                      // that locked the lock.
-};
 
+  // Statistics, updated by the holder; see lockdump().
+  uint nacquire;     // Times acquired
+  uint ncontend;     // Times acquire had to wait
+  uint64 spin;       // TSC cycles spent waiting
+  struct spinlock *nextlock;  // In the list of all static locks
+  int listed;        // On that list
+};
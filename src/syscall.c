@@ -22,6 +22,8 @@ fetchint(uint addr, int *ip)
   // curproc->sz: ユーザの仮想アドレス空間における使用領域の最上部(heapが確保されている場合はその頂点)
   if(addr >= curproc->sz || addr+4 > curproc->sz)
     return -1;
+  if(faultin(curproc, addr, 4) < 0)
+    return -1;
   // ポインタを参照して値を取りだす
   *ip = *(int*)(addr);
   return 0;
@@ -43,6 +45,9 @@ fetchstr(uint addr, char **pp)
   // 終端文字まで読み込む
   // 見つからなかったらユーザ空間から外に出てしまうため，エラーとする
   for(s = *pp; s < ep; s++){
+    // Bring in each page before reading it; see faultin.
+    if((s == *pp || (uint)s % PGSIZE == 0) && faultin(curproc, (uint)s, 1) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -72,6 +77,10 @@ argptr(int n, char **pp, int size)
     return -1;
   if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
     return -1;
+  // The caller may access the buffer while holding a spinlock
+  // (e.g. piperead), so bring any demand-paged pages in now.
+  if(faultin(curproc, i, size) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
@@ -110,6 +119,11 @@ extern int sys_unlink(void);
 extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
+extern int sys_setsched(void);
+extern int sys_getsched(void);
+extern int sys_clock(void);
+extern int sys_splice(void);
+extern int sys_fsync(void);
 
 // syscalls is an array of function returning static int
 static int (*syscalls[])(void) = {
@@ -134,8 +148,29 @@ static int (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_setsched] sys_setsched,
+[SYS_getsched] sys_getsched,
+[SYS_clock]   sys_clock,
+[SYS_splice]  sys_splice,
+[SYS_fsync]   sys_fsync,
 };
 
+// System call made with SYSENTER; see sysentry in trapasm.S.
+// tf is laid out as if by int $T_SYSCALL, but without trap()'s
+// dispatch on the trap number.
+void
+fastsyscall(struct trapframe *tf)
+{
+  struct proc *curproc = myproc();
+
+  if(curproc->killed)
+    exit();
+  curproc->tf = tf;
+  syscall();
+  if(curproc->killed)
+    exit();
+}
+
 void
 syscall(void)
 {
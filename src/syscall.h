@@ -20,3 +20,8 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_setsched 22
+#define SYS_getsched 23
+#define SYS_clock  24
+#define SYS_splice 25
+#define SYS_fsync  26
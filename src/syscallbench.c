@@ -0,0 +1,63 @@
+// System call latency benchmark.
+//
+// Times NCALL getpid() calls made through the usys.S stub, which
+// uses SYSENTER if the CPU has it, and NCALL more made with
+// int $T_SYSCALL, the way every system call used to enter the
+// kernel, and prints the average cost of each.  Time is measured
+// with clock().
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "date.h"
+#include "syscall.h"
+#include "traps.h"
+
+#define NCALL   100000
+
+// getpid() through the interrupt gate
+static int
+intgetpid(void)
+{
+  int pid;
+
+  asm volatile("int %2" : "=a" (pid) : "a" (SYS_getpid), "i" (T_SYSCALL)
+                        : "memory");
+  return pid;
+}
+
+static void
+report(char *what, uint us)
+{
+  printf(1, "syscallbench: %s %d calls in %d us (%d ns each)\n",
+         what, NCALL, us, us * (1000 / 10) / (NCALL / 10));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, pid;
+  struct clockval t0, t1;
+
+  printf(1, "syscallbench starting\n");
+  pid = getpid();
+
+  clock(&t0);
+  for(i = 0; i < NCALL; i++)
+    if(getpid() != pid){
+      printf(1, "syscallbench: getpid failed\n");
+      exit();
+    }
+  clock(&t1);
+  report("stub", clockus(&t0, &t1));
+
+  clock(&t0);
+  for(i = 0; i < NCALL; i++)
+    if(intgetpid() != pid){
+      printf(1, "syscallbench: int getpid failed\n");
+      exit();
+    }
+  clock(&t1);
+  report("int", clockus(&t0, &t1));
+  exit();
+}
@@ -90,6 +90,31 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// Wait until the writes to fd, and all other finished writes,
+// are on disk.
+int
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0 || f->type != FD_INODE)
+    return -1;
+  log_sync();
+  return 0;
+}
+
+// Move up to n bytes from fd in to fd out within the kernel.
+int
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
 int
 sys_close(void)
 {
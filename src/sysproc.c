@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "sched.h"
 
 int
 sys_fork(void)
@@ -59,26 +60,17 @@ sys_sbrk(void)
 int
 sys_sleep(void)
 {
-  int n;
-  uint ticks0;
+  int n, r;
 
   if(argint(0, &n) < 0)
     return -1;
   acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(myproc()->killed){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
+  r = timersleep(n);
   release(&tickslock);
-  return 0;
+  return r;
 }
 
-// return how many clock tick interrupts have occurred
-// since start.
+// return how many clock ticks have passed since start.
 int
 sys_uptime(void)
 {
@@ -89,3 +81,40 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// return the time since start in ticks and fractions of a tick.
+int
+sys_clock(void)
+{
+  struct clockval *cv, c;
+
+  if(argptr(0, (void*)&cv, sizeof(*cv)) < 0)
+    return -1;
+  clockread(&c);
+  *cv = c;
+  return 0;
+}
+
+// set the scheduling class and priority of a process;
+// pid 0 means the caller.
+int
+sys_setsched(void)
+{
+  int pid, class, prio;
+
+  if(argint(0, &pid) < 0 || argint(1, &class) < 0 || argint(2, &prio) < 0)
+    return -1;
+  return setsched(pid, class, prio);
+}
+
+// return the scheduling state and CPU accounting of a process.
+int
+sys_getsched(void)
+{
+  int pid;
+  struct schedinfo *si;
+
+  if(argint(0, &pid) < 0 || argptr(1, (void*)&si, sizeof(*si)) < 0)
+    return -1;
+  return getsched(pid, si);
+}
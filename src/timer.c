@@ -0,0 +1,226 @@
+// Timers for sleep(n): a two-level timer wheel driven by the clock.
+//
+// A sleeping process hangs a timer for its wake-up tick in the
+// wheel and sleeps on it, so it is woken once, when that tick
+// comes, rather than on every tick to check the time.
+//
+// wheel0 has a slot for each of the next WHEEL0 ticks; a timer due
+// within WHEEL0 ticks goes in the slot of its tick, and all timers
+// in the slot of the current tick are due.  wheel1 has a slot for
+// each span of WHEEL0 ticks; its timers move down to wheel0 when
+// their span comes up (cascade), or back into wheel1 if they are
+// further away than the whole wheel.  Adding, firing and cascading
+// are O(1) per timer.  Everything is protected by tickslock.
+//
+// Time is kept with the time-stamp counter, at tscpertick cycles
+// per tick (see lapicinit), not by counting interrupts: any CPU's
+// clock interrupt brings ticks up to date and runs the wheel for
+// every tick that has passed.  So a CPU with nothing to run can stop
+// its periodic tick and program a single interrupt for the next
+// timer (timeridle), and time stays right whichever CPUs are idle.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "x86.h"
+#include "date.h"
+
+#define WHEEL0  256
+#define WHEEL1  64
+// Longest an idle CPU goes without a clock interrupt, in ticks.
+#define IDLEMAX 100
+
+struct timer {
+  uint expire;         // tick to fire at
+  void *chan;          // what to wake up
+  struct timer *next;  // next in slot
+  struct timer **slot; // list it is on, or 0 once fired
+};
+
+static struct timer *wheel0[WHEEL0];
+static struct timer *wheel1[WHEEL1];
+static uint64 tscbase;  // time-stamp counter when tick `ticks` began
+
+// Put t in the slot for t->expire, or for tick ticks+soonest if
+// that is earlier.  soonest is 1 except from the cascade, which runs
+// before the current tick's slot and so may put timers into it.
+// Caller must hold tickslock.
+static void
+timeradd(struct timer *t, int soonest)
+{
+  int d;
+
+  d = t->expire - ticks;
+  if(d < soonest)
+    d = soonest;
+  if(d < WHEEL0)
+    t->slot = &wheel0[(ticks + d) % WHEEL0];
+  else if(d < WHEEL0 * WHEEL1)
+    t->slot = &wheel1[(t->expire / WHEEL0) % WHEEL1];
+  else  // beyond the wheel: park in the farthest slot
+    t->slot = &wheel1[(ticks / WHEEL0 + WHEEL1 - 1) % WHEEL1];
+  t->next = *t->slot;
+  *t->slot = t;
+}
+
+// Take t off its slot if it has not fired.
+// Caller must hold tickslock.
+static void
+timerdel(struct timer *t)
+{
+  struct timer **pp;
+
+  if(t->slot == 0)
+    return;
+  for(pp = t->slot; *pp; pp = &(*pp)->next){
+    if(*pp == t){
+      *pp = t->next;
+      break;
+    }
+  }
+  t->slot = 0;
+}
+
+// Called for every clock tick, after ticks is incremented,
+// with tickslock held.  Wake the sleepers whose timers are due.
+static void
+timertick(void)
+{
+  struct timer *t, *next;
+
+  if(ticks % WHEEL0 == 0){
+    t = wheel1[(ticks / WHEEL0) % WHEEL1];
+    wheel1[(ticks / WHEEL0) % WHEEL1] = 0;
+    for(; t; t = next){
+      next = t->next;
+      timeradd(t, 0);
+    }
+  }
+
+  t = wheel0[ticks % WHEEL0];
+  wheel0[ticks % WHEEL0] = 0;
+  for(; t; t = next){
+    next = t->next;
+    t->slot = 0;
+    wakeup(t->chan);
+  }
+}
+
+// Sleep for n ticks.  Caller must hold tickslock.
+// Return -1 if the process is killed meanwhile.
+int
+timersleep(uint n)
+{
+  struct timer t;
+  uint ticks0;
+
+  ticks0 = ticks;
+  t.expire = ticks0 + n;
+  t.chan = &t;
+  while(ticks - ticks0 < n){
+    if(myproc()->killed)
+      return -1;
+    timeradd(&t, 1);
+    sleep(&t, &tickslock);
+    timerdel(&t);  // in case kill() woke us
+  }
+  return 0;
+}
+
+// Like sleep(chan, &tickslock), but wake up after n ticks if
+// nothing else does first.  Caller must hold tickslock, so that
+// neither wakeup can be lost.
+void
+tsleep(void *chan, uint n)
+{
+  struct timer t;
+
+  t.expire = ticks + n;
+  t.chan = chan;
+  timeradd(&t, 1);
+  sleep(chan, &tickslock);
+  timerdel(&t);
+}
+
+void
+timerinit(void)
+{
+  tscbase = rdtsc();
+}
+
+// Bring ticks up to date with the time-stamp counter, running
+// the wheel for each tick that has passed.  Return the cycles
+// since the current tick began.  Caller must hold tickslock.
+static uint
+clockadvance(void)
+{
+  uint64 now;
+
+  if(tscpertick == 0)  // no lapic timer, no clock
+    return 0;
+  now = rdtsc();
+  // This CPU's counter may lag slightly behind the one that
+  // last advanced the clock.
+  if((long long)(now - tscbase) < 0)
+    return 0;
+  while(now - tscbase >= tscpertick){
+    tscbase += tscpertick;
+    ticks++;
+    timertick();
+  }
+  return now - tscbase;
+}
+
+// Clock interrupt, on any CPU.
+void
+clockintr(void)
+{
+  acquire(&tickslock);
+  clockadvance();
+  release(&tickslock);
+}
+
+// Read the time since boot, with sub-tick resolution.
+void
+clockread(struct clockval *cv)
+{
+  uint d;
+
+  acquire(&tickslock);
+  d = clockadvance();
+  cv->ticks = ticks;
+  cv->frac = tscpertick ? muldiv(d, CLOCKRES, tscpertick) : 0;
+  release(&tickslock);
+}
+
+// Called by scheduler() with interrupts off before it halts a CPU
+// that has nothing to run.  Replace the CPU's periodic tick by one
+// interrupt when the next timer is due, or after IDLEMAX ticks.
+// The scheduler restores the periodic tick when the CPU wakes up.
+void
+timeridle(void)
+{
+  uint n, d;
+  int i;
+
+  acquire(&tickslock);
+  d = clockadvance();
+  for(n = 1; n < IDLEMAX && n < WHEEL0; n++)
+    if(wheel0[(ticks + n) % WHEEL0])
+      break;
+  // A wheel1 timer may come due before it cascades into
+  // wheel0; wake at the cascade to look again.
+  for(i = 0; i < WHEEL1; i++){
+    if(wheel1[i]){
+      if(n > WHEEL0 - ticks % WHEEL0)
+        n = WHEEL0 - ticks % WHEEL0;
+      break;
+    }
+  }
+  release(&tickslock);
+  lapiconeshot(n, d);
+}
@@ -13,6 +13,8 @@
 // idtはCPU内部のレジスタ
 struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
+extern char sysentry[]; // in trapasm.S: SYSENTER entry point
+int sysenterok;         // CPUs have SYSENTER; see idtinit, switchuvm
 struct spinlock tickslock;
 uint ticks;
 
@@ -28,6 +30,8 @@ tvinit(void)
     SETGATE(idt[i], 0, SEG_KCODE<<3, vectors[i], 0);
   // システムコールだけはユーザ空間から実行できるように設定
   SETGATE(idt[T_SYSCALL], 1, SEG_KCODE<<3, vectors[T_SYSCALL], DPL_USER);
+  // usys.S uses SYSENTER instead of int if the CPU has it.
+  sysenterok = (cpufeatures() & CPUID_SEP) != 0;
 
   initlock(&tickslock, "time");
 }
@@ -37,6 +41,13 @@ void
 idtinit(void)
 {
   lidt(idt, sizeof(idt));
+  // SYSENTER enters the kernel at sysentry, with %cs SEG_KCODE and
+  // %ss SEG_KDATA; SYSEXIT returns with SEG_UCODE and SEG_UDATA,
+  // the two after them.  switchuvm sets %esp for each process.
+  if(sysenterok){
+    wrmsr(MSR_SYSENTER_CS, SEG_KCODE<<3);
+    wrmsr(MSR_SYSENTER_EIP, (uint)sysentry);
+  }
 }
 
 //PAGEBREAK: 41
@@ -56,13 +67,10 @@ trap(struct trapframe *tf)
 
   switch(tf->trapno){
   // T_IRQ0でかつIRQ_TIMER
+  // Every CPU advances the clock, since any of them may be idle
+  // with its periodic tick stopped (see timeridle).
   case T_IRQ0 + IRQ_TIMER:
-    if(cpuid() == 0){
-      acquire(&tickslock);
-      ticks++;
-      wakeup(&ticks);
-      release(&tickslock);
-    }
+    clockintr();
 	// 割り込みがあったことをLAPICに伝える
     lapiceoi();
     break;
@@ -82,6 +90,26 @@ trap(struct trapframe *tf)
     uartintr();
     lapiceoi();
     break;
+  // Another CPU queued work for this one while it was halted
+  // in scheduler(); returning from the interrupt is enough.
+  case T_IRQ0 + IRQ_RESCHED:
+    lapiceoi();
+    break;
+  // Copy-on-write or lazily allocated user page, touched from
+  // user space; or a copy-on-write page written by the kernel in
+  // a system call, whose buffers faultin() has made present.
+  case T_PGFLT:
+    if(myproc() && pagefault(myproc(), rcr2(), tf->err) == 0)
+      break;
+    goto bad;
+  // SYSENTER with TF set in the user's eflags single-steps into the
+  // kernel: the trap comes at sysentry, which then clears TF.
+  case T_DEBUG:
+    if((tf->cs&3) == 0 && tf->eip == (uint)sysentry){
+      tf->eflags &= ~FL_TF;
+      break;
+    }
+    goto bad;
   case T_IRQ0 + 7:
   case T_IRQ0 + IRQ_SPURIOUS:
     cprintf("cpu%d: spurious interrupt at %x:%x\n",
@@ -91,6 +119,7 @@ trap(struct trapframe *tf)
 
   //PAGEBREAK: 13
   default:
+  bad:
     if(myproc() == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d eip %x (cr2=0x%x)\n",
@@ -111,10 +140,11 @@ trap(struct trapframe *tf)
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
 
-  // Force process to give up CPU on clock tick.
+  // Force process to give up CPU on clock tick if its time slice
+  // is used up or a higher priority process is waiting.
   // If interrupts were on while locks held, would need to check nlock.
   if(myproc() && myproc()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER)
+     tf->trapno == T_IRQ0+IRQ_TIMER && schedtick())
     yield();
 
   // Check if the process has been killed since we yielded
@@ -36,5 +36,6 @@
 #define IRQ_COM1         4
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
+#define IRQ_RESCHED     30      // IPI: wake a halted CPU, work is queued
 #define IRQ_SPURIOUS    31
 
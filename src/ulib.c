@@ -3,6 +3,7 @@
 #include "fcntl.h"
 #include "user.h"
 #include "x86.h"
+#include "date.h"
 
 char*
 strcpy(char *s, char *t)
@@ -103,3 +104,12 @@ memmove(void *vdst, void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// Microseconds from clock() reading t0 to t1.
+uint
+clockus(struct clockval *t0, struct clockval *t1)
+{
+  return (t1->ticks - t0->ticks) * (1000000 / HZ) +
+         t1->frac / (CLOCKRES / (1000000 / HZ)) -
+         t0->frac / (CLOCKRES / (1000000 / HZ));
+}
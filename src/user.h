@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct schedinfo;
+struct clockval;
 
 // system calls
 int fork(void);
@@ -23,6 +25,11 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int setsched(int, int, int);
+int getsched(int, struct schedinfo*);
+int clock(struct clockval*);
+int splice(int, int, int);
+int fsync(int);
 
 // ulib.c
 int stat(char*, struct stat*);
@@ -37,3 +44,4 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+uint clockus(struct clockval*, struct clockval*);
@@ -7,6 +7,8 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "date.h"
+#include "sched.h"
 
 char buf[8192];
 char name[3];
@@ -184,6 +186,10 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// More blocks than twelve direct and one indirect block of
+// addresses could map, but few enough to fit on the disk.
+#define NBIG 400
+
 void
 writetest1(void)
 {
@@ -197,7 +203,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBIG; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -217,7 +223,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != NBIG){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -241,6 +247,61 @@ writetest1(void)
   printf(stdout, "big files ok\n");
 }
 
+// Two files written a block at a time in turn are laid out
+// interleaved on disk, so every block starts a new extent.  With
+// NFRAG blocks each they need more extent slots than the inode
+// and its singly-indirect block hold.
+#define NFRAG 120
+
+void
+fragtest(void)
+{
+  int fd[2], i, j, n;
+
+  printf(stdout, "fragmented files test\n");
+
+  fd[0] = open("frag0", O_CREATE|O_RDWR);
+  fd[1] = open("frag1", O_CREATE|O_RDWR);
+  if(fd[0] < 0 || fd[1] < 0){
+    printf(stdout, "error: creat frag failed!\n");
+    exit();
+  }
+  for(i = 0; i < NFRAG; i++){
+    for(j = 0; j < 2; j++){
+      ((int*)buf)[0] = i;
+      ((int*)buf)[1] = j;
+      if(write(fd[j], buf, 512) != 512){
+        printf(stdout, "error: write frag%d block %d failed\n", j, i);
+        exit();
+      }
+    }
+  }
+  close(fd[0]);
+  close(fd[1]);
+
+  fd[0] = open("frag0", O_RDONLY);
+  fd[1] = open("frag1", O_RDONLY);
+  for(j = 0; j < 2; j++){
+    for(n = 0; (i = read(fd[j], buf, 512)) == 512; n++){
+      if(((int*)buf)[0] != n || ((int*)buf)[1] != j){
+        printf(stdout, "frag%d block %d has %d %d\n", j, n,
+               ((int*)buf)[0], ((int*)buf)[1]);
+        exit();
+      }
+    }
+    if(i != 0 || n != NFRAG){
+      printf(stdout, "read only %d blocks from frag%d\n", n, j);
+      exit();
+    }
+    close(fd[j]);
+  }
+  if(unlink("frag0") < 0 || unlink("frag1") < 0){
+    printf(stdout, "unlink frag failed\n");
+    exit();
+  }
+  printf(stdout, "fragmented files ok\n");
+}
+
 void
 createtest(void)
 {
@@ -1606,6 +1667,306 @@ bsstest(void)
   printf(stdout, "bss test ok\n");
 }
 
+// copy-on-write fork: parent and child must each see
+// only their own writes to pages they shared at fork,
+// including writes the kernel makes on their behalf.
+void
+cowtest(void)
+{
+  char *a;
+  int i, pid, fds[2];
+
+  printf(stdout, "cow test\n");
+  a = sbrk(4*4096);
+  for(i = 0; i < 4*4096; i += 4096)
+    a[i] = 'p';
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    // read() into a shared page writes it from the kernel
+    if(read(fds[0], a+1, 1) != 1 || a[1] != 'x'){
+      printf(stdout, "cow test child read failed\n");
+      exit();
+    }
+    for(i = 0; i < 4*4096; i += 4096)
+      a[i] = 'c';
+    for(i = 0; i < 4*4096; i += 4096){
+      if(a[i] != 'c'){
+        printf(stdout, "cow test child saw parent's data\n");
+        exit();
+      }
+    }
+    exit();
+  }
+  write(fds[1], "x", 1);
+  wait();
+  close(fds[0]);
+  close(fds[1]);
+  for(i = 0; i < 4*4096; i += 4096){
+    if(a[i] != 'p'){
+      printf(stdout, "cow test failed: parent saw child's write\n");
+      exit();
+    }
+  }
+  if(a[1] == 'x'){
+    printf(stdout, "cow test failed: parent saw child's read\n");
+    exit();
+  }
+  sbrk(-4*4096);
+  printf(stdout, "cow test ok\n");
+}
+
+// sbrk only reserves address space; pages must appear,
+// zeroed, when touched by the process or by the kernel.
+void
+lazytest(void)
+{
+  char *a, *oldbrk;
+  int i, fd;
+
+  printf(stdout, "lazy sbrk test\n");
+  oldbrk = sbrk(0);
+  a = sbrk(16*1024*1024);
+  if(a == (char*)0xffffffff){
+    printf(stdout, "lazy sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < 16*1024*1024; i += 1024*1024){
+    if(a[i] != 0){
+      printf(stdout, "lazy sbrk page not zeroed\n");
+      exit();
+    }
+    a[i] = 1;
+  }
+  // let the kernel fault in a never-touched page
+  fd = open("echo", O_RDONLY);
+  if(fd < 0 || read(fd, a + 4096*3, 4) != 4 || a[4096*3+1] != 'E'){
+    printf(stdout, "lazy sbrk read into untouched page failed\n");
+    exit();
+  }
+  close(fd);
+  sbrk(-(sbrk(0) - oldbrk));
+  printf(stdout, "lazy sbrk test ok\n");
+}
+
+// fsync() waits for the log to commit; only files can be synced.
+void
+fsynctest(void)
+{
+  int fd, fds[2];
+
+  printf(stdout, "fsync test\n");
+  fd = open("fsync.tmp", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "durable", 7) != 7){
+    printf(stdout, "fsync: create failed\n");
+    exit();
+  }
+  if(fsync(fd) != 0){
+    printf(stdout, "fsync: fsync failed\n");
+    exit();
+  }
+  close(fd);
+  if(fsync(fd) != -1){
+    printf(stdout, "fsync: closed fd synced\n");
+    exit();
+  }
+  if(pipe(fds) != 0){
+    printf(stdout, "fsync: pipe failed\n");
+    exit();
+  }
+  if(fsync(fds[1]) != -1){
+    printf(stdout, "fsync: pipe synced\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  unlink("fsync.tmp");
+  printf(stdout, "fsync ok\n");
+}
+
+// splice() moves file data into a pipe and into another file.
+void
+splicetest(void)
+{
+  int fd, fd2, fds[2], i, n, pid;
+
+  printf(stdout, "splice test\n");
+  fd = open("splice.src", O_CREATE|O_RDWR);
+  for(i = 0; i < 3000; i++)
+    buf[i] = i % 251;
+  if(fd < 0 || write(fd, buf, 3000) != 3000){
+    printf(stdout, "splice: create failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("splice.src", O_RDONLY);
+  if(pipe(fds) != 0){
+    printf(stdout, "splice: pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    close(fds[1]);
+    n = 0;
+    while((i = read(fds[0], buf + n, sizeof(buf) - n)) > 0)
+      n += i;
+    for(i = 0; i < n; i++)
+      if(buf[i] != (char)(i % 251))
+        break;
+    if(n != 3000 || i != n){
+      printf(stdout, "splice: wrong data through pipe\n");
+      exit();
+    }
+    exit();
+  }
+  close(fds[0]);
+  if(splice(fd, fds[1], 10000) != 3000){
+    printf(stdout, "splice: file to pipe failed\n");
+    exit();
+  }
+  close(fds[1]);
+  close(fd);
+  wait();
+
+  fd = open("splice.src", O_RDONLY);
+  fd2 = open("splice.dst", O_CREATE|O_RDWR);
+  if(splice(fd, fd2, 10000) != 3000 || splice(fd, fd2, 10000) != 0){
+    printf(stdout, "splice: file to file failed\n");
+    exit();
+  }
+  close(fd);
+  close(fd2);
+  memset(buf, 0, 3000);
+  fd2 = open("splice.dst", O_RDONLY);
+  if(read(fd2, buf, sizeof(buf)) != 3000){
+    printf(stdout, "splice: wrong size\n");
+    exit();
+  }
+  for(i = 0; i < 3000; i++){
+    if(buf[i] != (char)(i % 251)){
+      printf(stdout, "splice: wrong data in file\n");
+      exit();
+    }
+  }
+  close(fd2);
+  unlink("splice.src");
+  unlink("splice.dst");
+  printf(stdout, "splice test ok\n");
+}
+
+// A running program is paged in from its file, so the file must
+// not be writable while it runs.  Writes back what is already
+// there, in case the kernel lets the write through.
+void
+exewrite(void)
+{
+  int fd;
+  char b[16];
+
+  printf(1, "exewrite test\n");
+  fd = open("usertests", O_RDWR);
+  if(fd < 0){
+    printf(1, "open usertests failed\n");
+    exit();
+  }
+  if(read(fd, b, sizeof(b)) != sizeof(b)){
+    printf(1, "read usertests failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("usertests", O_WRONLY);
+  if(fd < 0){
+    printf(1, "open usertests failed\n");
+    exit();
+  }
+  if(write(fd, b, sizeof(b)) >= 0){
+    printf(1, "write to running usertests succeeded!\n");
+    exit();
+  }
+  close(fd);
+  printf(1, "exewrite ok\n");
+}
+
+// setsched() may change only the caller and its descendants,
+// and may not give a fixed priority the top level.
+void
+schedperm(void)
+{
+  int pid;
+
+  printf(1, "schedperm test\n");
+  if(setsched(1, SCHED_FIXED, 1) == 0){
+    printf(1, "setsched of init succeeded!\n");
+    exit();
+  }
+  if(setsched(0, SCHED_FIXED, 0) == 0){
+    printf(1, "setsched fixed 0 succeeded!\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    sleep(10);
+    exit();
+  }
+  if(setsched(pid, SCHED_FIXED, 1) < 0){
+    printf(1, "setsched of child failed\n");
+    exit();
+  }
+  wait();
+  printf(1, "schedperm ok\n");
+}
+
+// clock() must never go backwards, must agree with uptime(),
+// and must resolve time finer than a tick.
+void
+clocktest(void)
+{
+  struct clockval a, b;
+  int i, finer;
+
+  printf(stdout, "clock test\n");
+  finer = 0;
+  if(clock(&a) < 0){
+    printf(stdout, "clock failed\n");
+    exit();
+  }
+  for(i = 0; i < 100000; i++){
+    clock(&b);
+    if(b.frac >= CLOCKRES || b.ticks < a.ticks ||
+       (b.ticks == a.ticks && b.frac < a.frac)){
+      printf(stdout, "clock went backwards\n");
+      exit();
+    }
+    if(b.ticks == a.ticks && b.frac > a.frac)
+      finer = 1;
+    a = b;
+  }
+  if(!finer){
+    printf(stdout, "clock has no sub-tick resolution\n");
+    exit();
+  }
+  clock(&a);
+  sleep(2);
+  clock(&b);
+  if(b.ticks - a.ticks < 2 || b.ticks > uptime()){
+    printf(stdout, "clock disagrees with sleep/uptime\n");
+    exit();
+  }
+  printf(stdout, "clock test ok\n");
+}
+
 // does exec return an error if the arguments
 // are larger than a page? or does it write
 // below the stack and wreck the instructions/data?
@@ -1724,6 +2085,53 @@ uio()
   printf(1, "uio test done\n");
 }
 
+// A system call made with SYSENTER and TF set traps into the
+// kernel at its entry point; that must not panic the kernel, and
+// the call must still complete.
+void
+syscalltf(void)
+{
+  int fds[2], pid, r;
+  uint edx;
+
+  printf(1, "syscall tf test\n");
+  asm volatile("cpuid" : "=d" (edx) : "a" (1) : "ebx", "ecx");
+  if((edx & 0x800) == 0){
+    printf(1, "no sysenter; syscall tf test skipped\n");
+    return;
+  }
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    close(fds[0]);
+    asm volatile("pushfl\n"
+                 "orl $0x100, (%%esp)\n"   // FL_TF
+                 "leal 4(%%esp), %%ecx\n"  // %esp after popfl
+                 "movl $1f, %%edx\n"
+                 "popfl\n"
+                 "sysenter\n"
+                 "1:\n"
+                 : "=a" (r) : "a" (SYS_getpid) : "ecx", "edx", "memory", "cc");
+    if(r == getpid())
+      write(fds[1], "x", 1);
+    exit();
+  } else if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  close(fds[1]);
+  if(read(fds[0], buf, 1) != 1){
+    printf(1, "syscall tf test failed\n");
+    exit();
+  }
+  close(fds[0]);
+  wait();
+  printf(1, "syscall tf ok\n");
+}
+
 void argptest()
 {
   int fd;
@@ -1768,11 +2176,15 @@ main(int argc, char *argv[])
   bigargtest();
   bsstest();
   sbrktest();
+  lazytest();
+  cowtest();
   validatetest();
 
   opentest();
   writetest();
   writetest1();
+  fragtest();
+  fsynctest();
   createtest();
 
   openiputtest();
@@ -1781,7 +2193,11 @@ main(int argc, char *argv[])
 
   mem();
   pipe1();
+  splicetest();
   preempt();
+  clocktest();
+  schedperm();
+  exewrite();
   exitwait();
 
   rmdot();
@@ -1796,6 +2212,7 @@ main(int argc, char *argv[])
   bigdir(); // slow
 
   uio();
+  syscalltf();
 
   exectest();
 
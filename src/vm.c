@@ -9,6 +9,9 @@
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
+static char *sinkpage; // takes kernel writes for a killed process; see pagefault
+
+static void pgdirput(pde_t*);
 
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
@@ -21,12 +24,20 @@ seginit(void)
   // Cannot share a CODE descriptor for both kernel and user
   // because it would have to have DPL_USR, but the CPU forbids
   // an interrupt from CPL=0 to DPL=3.
-  c = &cpus[cpuid()];
+  c = cpulookup();
   c->gdt[SEG_KCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, 0);
   c->gdt[SEG_KDATA] = SEG(STA_W, 0, 0xffffffff, 0);
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
+
+  // Map cpu-local storage.  %gs holds SEG_KCPU, whose base is this
+  // CPU's struct cpu, whenever the kernel runs (alltraps loads it);
+  // mycpu() and myproc() read through it.
+  c->gdt[SEG_KCPU] = SEG16(STA_W, c, sizeof(*c)-1, 0);
+  c->self = c;
+
   lgdt(c->gdt, sizeof(c->gdt));
+  loadgs(SEG_KCPU << 3);
 }
 
 // Return the address of the PTE in page table pgdir
@@ -43,6 +54,8 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   // pdeにはvaに対応するページテーブルへのアドレスが入る
   // PDX: vaの上位10bitを見て、ページディレクトリ内のページテーブルへのオフセットを求める
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return 0;  // a 4MB kernel page: there is no page table
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
@@ -98,6 +111,17 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 // page protection bits prevent user code from using the kernel's
 // mappings.
 //
+// The kernel's mappings are built once, in kpgdir, and shared: a
+// process's page directory gets copies of kpgdir's entries for
+// KERNBASE and above, which point at the same page tables, and its
+// own page tables only for user memory.  Wherever a kmap range
+// covers a whole 4MB-aligned block it is mapped with one 4MB
+// (PTE_PS) page directory entry and no page table, as entrypgdir
+// does; only the first 4MB, where the kernel text must stay
+// read-only, needs a page table.  Since they are the same in every
+// page table, the kernel's mappings are global (PTE_G): loading %cr3
+// flushes only the user part of the TLB.
+//
 // setupkvm() and exec() set up every page table like this:
 //
 //   0..KERNBASE: user memory (text+data+stack+heap), mapped to
@@ -128,52 +152,88 @@ static struct kmap {
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
+// Like mappages, but map whole 4MB-aligned blocks with 4MB pages,
+// and make every mapping global.
+// For the kernel's mappings in kpgdir only.
+static int
+mapkern(pde_t *pgdir, void *va, uint size, uint pa, int perm)
+{
+  uint a, last;
+  pte_t *pte;
+
+  a = PGROUNDDOWN((uint)va);
+  last = PGROUNDDOWN((uint)va + size - 1);
+  for(;;){
+    if(a % BIGPGSIZE == 0 && pa % BIGPGSIZE == 0 &&
+       last - a >= BIGPGSIZE - PGSIZE){
+      if(pgdir[PDX(a)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(a)] = pa | perm | PTE_P | PTE_PS | PTE_G;
+      if(last - a == BIGPGSIZE - PGSIZE)
+        break;
+      a += BIGPGSIZE;
+      pa += BIGPGSIZE;
+    } else {
+      if((pte = walkpgdir(pgdir, (void*)a, 1)) == 0)
+        return -1;
+      if(*pte & PTE_P)
+        panic("remap");
+      *pte = pa | perm | PTE_P | PTE_G;
+      if(a == last)
+        break;
+      a += PGSIZE;
+      pa += PGSIZE;
+    }
+  }
+  return 0;
+}
+
 // Set up kernel part of a page table.
-// ページディレクトリのための物理メモリを確保し、kmapに記された通りにマッピングを行う
-// マッピングされたpgdirへのアドレスを返す
+// ページディレクトリのための物理メモリを確保し、kpgdirのカーネル部分をコピーする
+// ページテーブルはすべてのプロセスで共有される
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
   // kalloc(): kmem.freelistの先頭アドレスが返ってくる
   // 1024個のエントリ(4*1024=4KB)が格納できる領域を確保
   if((pgdir = (pde_t*)kalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  // DEVSPACEは仮想アドレス空間におけるMMIOのアドレスのスタート番地
-  // PHYSTOPは使用するメモリの限界値を意味し、これがDEVSPACEより大きいとMMIO領域を侵食しかねない
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  // kmapに定義されているカーネルのアドレス空間にしたがってマッピングを行う
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-	// mappages: pgdirに対して必要に応じてページテーブルの領域を確保し、pteを作成する
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-	  // 割り当てる物理アドレスがなかった場合にこのセクションに入る
-	  // まず呼ばれることはない
-	  // pgdirでマッピングされている全物理アドレスを解放しフリーリストへ追加
-	  // pgdirそのものの実体も解放し、フリーリストへ追加
-      freevm(pgdir);
-      return 0;
-    }
+  memset(pgdir, 0, PDX(KERNBASE) * sizeof(pde_t));
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
   return pgdir;
 }
 
 // Allocate one page table for the machine for the kernel address
 // space for scheduler processes.
 // kpgdirを作成し、カーネルのページテーブルをセットする=>entrypgdirは無効になる
+// 以後setupkvmはこのkpgdirのカーネル部分をコピーするだけ
 void
 kvmalloc(void)
 {
-  // カーネルのテージテーブルのみマッピング
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  if((kpgdir = (pde_t*)kalloc()) == 0 || (sinkpage = kalloc()) == 0)
+    panic("kvmalloc: out of memory");
+  memset(kpgdir, 0, PGSIZE);
+  // DEVSPACEは仮想アドレス空間におけるMMIOのアドレスのスタート番地
+  // PHYSTOPは使用するメモリの限界値を意味し、これがDEVSPACEより大きいとMMIO領域を侵食しかねない
+  if (P2V(PHYSTOP) > (void*)DEVSPACE)
+    panic("PHYSTOP too high");
+  // kmapに定義されているカーネルのアドレス空間にしたがってマッピングを行う
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(mapkern(kpgdir, k->virt, k->phys_end - k->phys_start,
+               (uint)k->phys_start, k->perm) < 0)
+      panic("kvmalloc: out of memory");
   switchkvm();
 }
 
 // Switch h/w page table register to the kernel-only page table,
-// for when no process is running.
+// for a CPU that has not run any process yet.  Afterwards the
+// scheduler stays on the page table of the last process it ran
+// (see switchuvm).
 void
 switchkvm(void)
 {
@@ -189,6 +249,9 @@ switchkvm(void)
 void
 switchuvm(struct proc *p)
 {
+  struct cpu *c;
+  pde_t *old;
+
   if(p == 0)
     panic("switchuvm: no process");
   if(p->kstack == 0)
@@ -198,22 +261,34 @@ switchuvm(struct proc *p)
 
   // popcli()を実行されるまで割り込みされない
   pushcli();
-  mycpu()->gdt[SEG_TSS] = SEG16(STS_T32A, &mycpu()->ts,
-                                sizeof(mycpu()->ts)-1, 0);
-  mycpu()->gdt[SEG_TSS].s = 0;
+  c = mycpu();
+  c->gdt[SEG_TSS] = SEG16(STS_T32A, &c->ts, sizeof(c->ts)-1, 0);
+  c->gdt[SEG_TSS].s = 0;
   // カーネルのデータ，スタックを使用していることを示す
-  mycpu()->ts.ss0 = SEG_KDATA << 3;
+  c->ts.ss0 = SEG_KDATA << 3;
   // pのkstackのトップをtasksegmentのespにセット
-  mycpu()->ts.esp0 = (uint)p->kstack + KSTACKSIZE;
+  c->ts.esp0 = (uint)p->kstack + KSTACKSIZE;
   // setting IOPL=0 in eflags *and* iomb beyond the tss segment limit
   // forbids I/O instructions (e.g., inb and outb) from user space
   // iomb: I/O Mapped Base
-  mycpu()->ts.iomb = (ushort) 0xFFFF;
+  c->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
+  // SYSENTER takes its stack from an MSR, not from the TSS.
+  if(sysenterok)
+    wrmsr(MSR_SYSENTER_ESP, (uint)p->kstack + KSTACKSIZE);
   // 同じプロセスなのに再度cr3にpgdirをセットする理由は、
   // TLBのキャッシュを更新するため(ページの拡張、縮小による変化をTLBに伝達)
   // 仮にcr3に再セットしない場合、拡張されたページの以前のパーミッションがTLBに残っていて、そのページにアクセスできないなどが起こりうる
   lcr3(V2P(p->pgdir));  // switch to process's address space
+  // The page directory stays loaded after p stops running, until
+  // this CPU runs another process.  Hold a reference to it till
+  // then, so that it is not freed under this CPU if p exits or
+  // execs elsewhere meanwhile.
+  old = c->pgdir;
+  kincref((char*)p->pgdir);
+  c->pgdir = p->pgdir;
+  if(old)
+    pgdirput(old);
   // 一連の操作が完了したため，割り込みを受け取るようにcliをセットする
   popcli();
 }
@@ -324,8 +399,8 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       if(pa == 0)
         panic("kfree");
       char *v = P2V(pa);
-      kfree(v);
       *pte = 0;
+      kfree(v);
     }
   }
   return newsz;
@@ -334,17 +409,33 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 // Free a page table and all the physical memory pages
 // in the user part.
 // ページテーブルを解放し、対応する物理メモリも解放する
+// A CPU that last ran the process may still have pgdir loaded (see
+// switchuvm).  The user pages go now, their PTEs cleared first; the
+// emptied page tables and the directory go with the last reference,
+// so that a loaded directory never points at freed, junk-filled
+// page tables, whose junk PTEs would look present and global.
 void
 freevm(pde_t *pgdir)
 {
-  uint i;
-
   if(pgdir == 0)
     panic("freevm: no pgdir");
   // ユーザ空間のアドレス空間を縮小する
   deallocuvm(pgdir, KERNBASE, 0);
-  // pgdirのなかのページテーブルを線形に
-  for(i = 0; i < NPDENTRIES; i++){
+  pgdirput(pgdir);
+}
+
+// Drop a reference to pgdir, which maps no user pages any more.
+// The last one frees its page tables and pgdir itself.
+static void
+pgdirput(pde_t *pgdir)
+{
+  uint i;
+
+  if(kunref((char*)pgdir) > 0)
+    return;
+  // pgdirのなかのユーザ空間のページテーブルを線形に
+  // KERNBASE以上はkpgdirと共有しているので解放しない
+  for(i = 0; i < PDX(KERNBASE); i++){
     if(pgdir[i] & PTE_P){
 	  // ページテーブルのPPNを取り出し、仮想アドレスに変換
       char * v = P2V(PTE_ADDR(pgdir[i]));
@@ -371,36 +462,236 @@ clearpteu(pde_t *pgdir, char *uva)
 
 // Given a parent process's page table, create a copy
 // of it for a child.
+// No user memory is copied: every page is mapped into the child
+// as well, and writable pages are made read-only and PTE_COW in
+// both page tables.  cowfault() copies a page on the first write.
+// pgdir must be the current page table, since its TLB entries
+// are flushed here.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
   pte_t *pte;
   uint pa, i, flags;
-  char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+    // Pages reserved by sbrk but never touched are not mapped;
+    // the child will fault them in itself.
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
     if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+      continue;
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0)
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
       goto bad;
+    kincref(P2V(pa));
   }
+  // The parent's writable pages just became read-only.
+  lcr3(V2P(pgdir));
   return d;
 
 bad:
+  lcr3(V2P(pgdir));
   freevm(d);
   return 0;
 }
 
+// Handle a write fault at user address va in pgdir.
+// If va is a copy-on-write page, give pgdir its own writable copy,
+// or just make the page writable if no one else maps it any more.
+// Returns 0 if the fault was handled, -1 if it is a real fault,
+// 1 if there was no memory for the copy.
+int
+cowfault(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint pa;
+  char *mem;
+
+  if(va >= KERNBASE)
+    return -1;
+  if((pte = walkpgdir(pgdir, (void*)va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_P|PTE_U|PTE_COW)) != (PTE_P|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE_ADDR(*pte);
+  if(krefcnt(P2V(pa)) == 1){
+    // The other sharers have copied or exited; the page is ours.
+    *pte = (*pte | PTE_W) & ~PTE_COW;
+  } else {
+    if((mem = kalloc()) == 0)
+      return 1;
+    memmove(mem, (char*)P2V(pa), PGSIZE);
+    *pte = V2P(mem) | ((PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW);
+    kfree((char*)P2V(pa));
+  }
+  invlpg((void*)PGROUNDDOWN(va));
+  return 0;
+}
+
+// Replace the copy-on-write page at va in pgdir with a writable
+// mapping of sinkpage, for a process that is being killed.
+static void
+cowsink(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint pa;
+
+  pte = walkpgdir(pgdir, (void*)va, 0);
+  pa = PTE_ADDR(*pte);
+  kincref(sinkpage);
+  *pte = V2P(sinkpage) | ((PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW);
+  kfree((char*)P2V(pa));
+  invlpg((void*)PGROUNDDOWN(va));
+}
+
+// Map a zeroed page at user address va in pgdir.  Used for
+// the heap, which sbrk() grows without allocating memory.
+// Returns 0 on success, -1 if out of memory.
+static int
+lazyalloc(pde_t *pgdir, uint va)
+{
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(mappages(pgdir, (char*)PGROUNDDOWN(va), PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Read the page containing user address va from the program file
+// if it lies in one of p's on-disk segments.  May sleep, so the
+// caller must not hold a spinlock; argptr() faults in system call
+// buffers up front so that the kernel never faults here with
+// a lock held.
+// Returns 0 on success, -1 if out of memory or the read failed,
+// 1 if va is not in a segment.
+static int
+pagein(struct proc *p, uint va)
+{
+  struct progseg *s;
+  char *mem;
+  uint a, n;
+
+  a = PGROUNDDOWN(va);
+  for(s = p->seg; s < &p->seg[p->nseg]; s++)
+    if(a >= s->vaddr && a < s->vaddr + s->memsz)
+      break;
+  if(s == &p->seg[p->nseg])
+    return 1;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(a - s->vaddr < s->filesz){
+    n = s->filesz - (a - s->vaddr);
+    if(n > PGSIZE)
+      n = PGSIZE;
+    ilock(p->exe);
+    if(readi(p->exe, mem, s->off + (a - s->vaddr), n) != n){
+      iunlock(p->exe);
+      kfree(mem);
+      return -1;
+    }
+    iunlock(p->exe);
+  }
+  if(mappages(p->pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return -1;
+  }
+  p->npagein++;
+  return 0;
+}
+
+// Bring in the not-present page at user address va of p.
+// Program text and data come from the file, the rest is heap.
+// Returns 0 on success, -1 if out of memory or the read failed.
+static int
+pagefill(struct proc *p, uint va)
+{
+  switch(pagein(p, va)){
+  case 0:
+    return 0;
+  case 1:
+    return lazyalloc(p->pgdir, va);
+  default:
+    return -1;
+  }
+}
+
+// Make sure the user pages in [va, va+n) are present, so that
+// the kernel can then access them without sleeping in pagefault.
+// Every system call argument the kernel reads or writes in user
+// memory goes through here first (argptr, fetchint, fetchstr).
+// Returns 0 on success, -1 if a page could not be brought in.
+int
+faultin(struct proc *p, uint va, uint n)
+{
+  uint a;
+  pte_t *pte;
+
+  if(n == 0)
+    return 0;
+  if(va >= p->sz || va + n > p->sz || va + n < va)
+    return -1;
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte && (*pte & PTE_P))
+      continue;
+    if(pagefill(p, a) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Handle a page fault at address va in process p; err is the
+// error code the processor pushed.  Returns 0 if the page is now
+// accessible and the faulting instruction can be restarted,
+// -1 if the access is invalid.
+int
+pagefault(struct proc *p, uint va, uint err)
+{
+  if(va >= p->sz)
+    return -1;
+  if(err & FEC_PR){
+    // Present but not writable: maybe copy-on-write.
+    if((err & FEC_WR) == 0)
+      return -1;
+    switch(cowfault(p->pgdir, va)){
+    case 0:
+      return 0;
+    case 1:
+      if(err & FEC_U)
+        return -1;
+      // Out of memory while the kernel writes to a system call
+      // buffer, e.g. in readi.  The write cannot be backed out:
+      // kill p, and let it go to sinkpage, which no one reads.
+      p->killed = 1;
+      cowsink(p->pgdir, va);
+      return 0;
+    default:
+      return -1;
+    }
+  }
+  // Not present: inside the process but never touched.  The
+  // kernel faults in what it accesses beforehand (faultin), so
+  // from the kernel this is a wild pointer; let trap() panic.
+  if((err & FEC_U) == 0)
+    return -1;
+  return pagefill(p, va);
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 // ユーザの仮想アドレス空間におけるuvaをKERNBASE以上のカーネルの仮想アドレス空間のkvaに変換する
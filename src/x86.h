@@ -121,6 +121,15 @@ sti(void)
   asm volatile("sti");
 }
 
+// Enable interrupts and halt until the next one.  sti takes
+// effect only after the following instruction, so an interrupt
+// that is already pending still wakes the hlt.
+static inline void
+stihlt(void)
+{
+  asm volatile("sti; hlt" : : : "memory");
+}
+
 // atomicに命令を実行するためのx86の命令
 static inline uint
 xchg(volatile uint *addr, uint newval)
@@ -137,6 +146,49 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+// Read the time-stamp counter.
+static inline uint64
+rdtsc(void)
+{
+  uint64 t;
+  asm volatile("rdtsc" : "=A" (t));
+  return t;
+}
+
+// Spin-wait hint: saves power and leaves the other hyperthread
+// the core while polling a lock.
+static inline void
+pause(void)
+{
+  asm volatile("pause");
+}
+
+// Return the feature flags in %edx of CPUID leaf 1.
+static inline uint
+cpufeatures(void)
+{
+  uint eax, ebx, ecx, edx;
+
+  asm volatile("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                       : "a" (1));
+  return edx;
+}
+
+static inline void
+wrmsr(uint msr, uint64 val)
+{
+  asm volatile("wrmsr" : : "c" (msr), "A" (val));
+}
+
+// a*b/c with a 64-bit product; the quotient must fit in 32 bits.
+static inline uint
+muldiv(uint a, uint b, uint c)
+{
+  uint q, r;
+  asm("mull %3; divl %4" : "=a" (q), "=&d" (r) : "0" (a), "rm" (b), "rm" (c) : "cc");
+  return q;
+}
+
 static inline uint
 rcr2(void)
 {
@@ -151,6 +203,13 @@ lcr3(uint val)
   asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+// Flush the TLB entry for the page containing addr.
+static inline void
+invlpg(void *addr)
+{
+  asm volatile("invlpg (%0)" : : "r" (addr) : "memory");
+}
+
 //PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().